@@ -48,6 +48,34 @@
  * the command: "echo n > /sys/devices/platform/amilo_pa2548/lcd_level", where
  * the 'n' is a single number in the range 0..7.
  *
+ * The file can be polled (POLLPRI) to wait for the brightness changes made
+ * through the driver.
+ *
+ * The file /sys/devices/platform/amilo_pa2548/lcd_state [mode: <b>666</b>]
+ * shows the level with its generation, e.g. "5@42"; the generation grows on
+ * every change of the level. Writing "level@generation" sets the level only
+ * if it was not changed since that read, otherwise the write fails with
+ * EAGAIN and the client reads the state again. Writing "level" sets it
+ * unconditionally.
+ *
+ * The writes of every user can be limited by the module parameters
+ * write_rate (per second, 0 - unlimited) and write_burst. The excess writes
+ * are not executed, only the latest level is set when the user may write
+ * again. The file /sys/devices/platform/amilo_pa2548/throttle shows the
+ * writers: "uid executed throttled".
+ *
+ * If the kernel has the power supply class the driver also exports the
+ * brightness profiles of the power sources [mode: <b>644</b>]:
+ * - /sys/devices/platform/amilo_pa2548/ac_level - the level on the AC adapter
+ * - /sys/devices/platform/amilo_pa2548/battery_level - the level on battery
+ * - /sys/devices/platform/amilo_pa2548/profile_mode - "target" (default) sets
+ *   the level of the profile when the power source is switched, "ceiling"
+ *   lowers the higher levels to it while the power source is active
+ *
+ * The level -1 (default) disables the profile. The profiles are applied by
+ * the driver on the AC adapter events, the write is skipped when the level
+ * is already set.
+ *
  * \subsection howtobacklight Using through the backlight interface
  *
  * Also you can use the backlight interface.
@@ -55,6 +83,17 @@
  * This is a standart way to change the brightness level. It is available to
  * userspace under /sys/class/backlight/amilo_pa2548/ (to version 2.6.32).
  *
+ * The hardware cannot turn the backlight off, level 0 is still lit, so
+ * writing 4 to bl_power blanks it by dimming to the lowest level through
+ * the selected backend (_BCM by default); writing 0 unblanks it.
+ *
+ * While the backlight is blanked or the lid is closed the brightness
+ * changes (the requests, the Fn-keys, the power source profiles) are not
+ * written to the hardware, only the last requested level is set when the
+ * display is on again. The backend watchdog does not probe meanwhile. The
+ * 'silentmode' LED is a status LED out of the panel, it stays visible
+ * while the backlight is blanked, so its writes are not postponed.
+ *
  * \subsection howtocontrolled How to control LEDs
  *
  * In order to turn a 'silentmode' led on/off you have to write into file:
@@ -64,11 +103,147 @@
  * - >= 127 - Half brightness (LED on)
  * - >= 0   - Null brightness (LED off)
  *
+ * The LED triggers set the brightness from the timer and interrupt context,
+ * so the driver only remembers it there and writes the last one from a work.
+ * The AML evaluation, the port sequences and the logging run only in
+ * preemptible context: the brightness paths hold the mutex, the LED work
+ * writes its single port without it. tools/amilo_pa2548_latency measures
+ * the scheduling latency the driver adds to other tasks under the brightness
+ * and LED load, e.g. on PREEMPT_RT kernels.
+ *
+ * \subsection howtoparams Module parameters
+ *
+ * - backend - the way to set the brightness level: "acpi" (default) evaluates
+ *   the _BCM method, "native" writes the EC register directly
+ * - features - the bitmask of the optional features, it can be changed at
+ *   runtime under /sys/module/amilo_pa2548/parameters/features:
+ *   - 0x01 - measure the latency of the Fn-keys handling
+ *   - 0x02 - record the trace of the entry point calls
+ *   - 0x04 - switch to the other backend when the preferred one is slow
+ * - hotkey_step - the brightness step of the Fn-keys (1 by default)
+ * - max_level - the highest brightness level which is set, the higher
+ *   requests are lowered to it (-1 by default - no ceiling)
+ * - watchdog_threshold_us, watchdog_percentile, watchdog_probe_ms - the
+ *   backend watchdog (feature 0x04): when the watchdog_percentile (90 by
+ *   default) of the last 16 latencies of the preferred backend exceeds
+ *   watchdog_threshold_us (10000 by default) the other backend is used; the
+ *   preferred one is probed every watchdog_probe_ms (30000 by default) and
+ *   used again after 3 successive fast probes; every switch is logged; the
+ *   first level set by the other backend is read back from the EC and if it
+ *   did not take effect the preferred backend is kept for good
+ *
+ * - housekeeping_cpus - the list of the CPUs, e.g. "0-1", which run all the
+ *   deferred work and the timers of the driver, so nothing of the driver
+ *   runs on the isolated (isolcpus, nohz_full) CPUs; all CPUs by default
+ * - ec_autoincrement - the EC increments the register index after every data
+ *   read, so the batched reads of the sequential registers (the debugfs file
+ *   'ec', the brightness level is one register) write the index once (0 by
+ *   default); such reads are checked by the indexed ones until 4 of them
+ *   agreed on the neighbouring registers which differ, the parameter is
+ *   ignored if 4 of them disagreed first
+ *
+ * The disabled features cost one well-predicted branch in the hot paths.
+ *
+ * \subsection howtocache Brightness level cache
+ *
+ * Every read of the brightness level accesses the EC ports, because the
+ * firmware changes the level on its own on the AC adapter, lid and video
+ * events. With the module parameter cache_level=1 the level is read from the
+ * hardware only once after such an event and then served from the cache.
+ * The cache needs the lid events of the ACPI button driver, without it the
+ * level is always read from the hardware.
+ *
+ * After the invalidation (the events above and the resume) the cache is
+ * refilled by a work at once, so the next reader does not pay for the port
+ * access. A reader which comes while the refill is in flight waits for it
+ * instead of reading the hardware once more.
+ *
+ * A cache hit does not take the lock: the level, its generation and the
+ * validity are published under a sequence counter, so the readers of
+ * lcd_level, lcd_state and the backlight do not serialize on each other or
+ * wait behind a slow write.
+ *
+ * \subsection howtopolicy Brightness policy
+ *
+ * The levels set by the Fn-keys and requested through the platform and
+ * backlight interfaces are chosen by the brightness policy. The default one
+ * is tuned by the parameters hotkey_step and max_level. Another module can
+ * replace it by amilo_pa2548_register_policy(), see amilo_pa2548_policy.h.
+ *
+ * \subsection howtostats Statistics
+ *
+ * The file /sys/devices/platform/amilo_pa2548/stats [mode: <b>444</b>] shows
+ * the counters of the brightness reads, writes, notifications and errors,
+ * the histogram of the brightness write latency and the current state (the
+ * level, the LED, the backend and the policy) in one read, one value per
+ * line. tools/amilo_pa2548_exporter serves it in the OpenMetrics format.
+ *
+ * The file /sys/devices/platform/amilo_pa2548/residency [mode: <b>644</b>]
+ * shows the cumulative time in ns spent at every brightness level and in
+ * every LED mode, it is accounted on the transitions without sampling. Write
+ * anything to it to reset it, e.g. at the start of a job.
+ *
+ * \subsection howtodebugfs Debugging through the debugfs
+ *
+ * If the kernel has the debugfs the driver exports the following files under
+ * /sys/kernel/debug/amilo_pa2548/:
+ *
+ * - hotkey_inject (to version 2.6.32) - write "0x86" (brightness up) or
+ *   "0x87" (brightness down) to handle a synthetic Fn-key event the same way
+ *   as a real one
+ * - hotkey_latency (to version 2.6.32) - read the per-stage latency of the
+ *   handled Fn-keys: the brightness write, the proc event, the input event
+ *   and the total; write anything to reset it; it is measured when the
+ *   feature 0x01 is enabled
+ * - trace - read the recorded calls, see amilo_pa2548_trace.h for the format;
+ *   the records are removed when read
+ * - trace_dropped - the number of records dropped because the trace was full
+ * - ec - read the EC registers of the set in one transaction: the time and
+ *   a "register value" line for every register; write the registers to set
+ *   them, e.g. "0xf3 0xf4" (the brightness register by default)
+ *
+ * The trace keeps up to trace_records (module parameter, 1024 by default)
+ * records, they are allocated once when the driver is loaded.
+ *
+ * The calls of the entry points (the platform and backlight brightness, the
+ * Fn-keys and the LED) are recorded when the feature 0x02 is enabled. The
+ * conditional writes of lcd_state are recorded with their generation.
+ *
+ * The recorded trace can be replayed with tools/amilo_pa2548_replay.
+ *
  * \section setup Installation
  *
  * Get the source tar-ball and extract it. Type "make" to build from sources a
  * kernel module, then type "make install" to install to the module dir.
  *
+ * Every subsystem can be compiled out to reduce the size of the module, pass
+ * "n" to the corresponding switch, e.g. "make CONFIG_AMILO_PA2548_LED=n":
+ * - CONFIG_AMILO_PA2548_BACKLIGHT - the backlight interface
+ * - CONFIG_AMILO_PA2548_PLATFORM_ATTR - the platform interface
+ * - CONFIG_AMILO_PA2548_LED - the LED interface
+ * - CONFIG_AMILO_PA2548_INPUT - the Fn-keys (to version 2.6.32)
+ * - CONFIG_AMILO_PA2548_DEBUGFS - the debugfs files
+ * - CONFIG_AMILO_PA2548_STATS - the statistics and residency files
+ *
+ * Type "make size-report" to see the size of the module for the typical sets
+ * of the subsystems.
+ *
+ * Type "make tools" to build the userspace tools under tools/:
+ * - amilo_pa2548_replay - replays a trace recorded through the debugfs
+ * - amilo_pa2548_stress - concurrency stress test of the loaded driver
+ * - libamilo_pa2548.a - the client library (see tools/libamilo_pa2548.h)
+ * - amilo_pa2548_ctl - the command line client built on the library
+ * - amilo_pa2548_exporter - the OpenMetrics exporter of the statistics
+ * - amilo_pa2548_latency - the scheduling latency under the driver load
+ *
+ * The script tools/amilo_pa2548_amlprof.sh profiles the _BCM and _BCL methods
+ * of a captured DSDT/SSDT with the ACPICA acpiexec: the opcodes, the region
+ * accesses and the wall time per call, to compare with the native backend.
+ *
+ * The script tools/amilo_pa2548_isolation.sh traces the functions of the
+ * loaded module under the brightness and LED load and fails if any of them
+ * runs on the isolated CPUs.
+ *
  * To autoload the module in the system startup add "amilo_pa2548" to your
  * rc-config.
  *
@@ -91,6 +266,33 @@
 #include <linux/string.h>
 #include <linux/leds.h>
 #include <linux/version.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/moduleparam.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
+#include <linux/fb.h>
+#include <linux/cred.h>
+#include <linux/cache.h>
+#include <linux/percpu.h>
+#include <linux/sort.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/seqlock.h>
+
+#if defined(CONFIG_ACPI_BUTTON) || defined(CONFIG_ACPI_BUTTON_MODULE)
+#include <acpi/button.h>
+#endif
+#if defined(CONFIG_POWER_SUPPLY) || defined(CONFIG_POWER_SUPPLY_MODULE)
+#include <linux/power_supply.h>
+#endif
+
+#include "amilo_pa2548_trace.h"
+#include "amilo_pa2548_policy.h"
 
 #if LINUX_VERSION_CODE > KERNEL_VERSION(2,6,31)
 #   define KERNEL_ALREADY_HAS_IT
@@ -103,6 +305,32 @@
 #   define BACKLIGHT_DEVICE_REGISTER_FIX
 #endif
 
+/*
+ * The subsystems are selected by the CONFIG_AMILO_PA2548_* switches of the
+ * Makefile: BACKLIGHT, PLATFORM_ATTR, LED, INPUT, DEBUGFS and STATS.
+ */
+
+/* the driver handles the Fn-keys itself */
+#if !defined(KERNEL_ALREADY_HAS_IT) && defined(CONFIG_AMILO_PA2548_INPUT)
+#   define HOTKEYS_SUPPORT
+#endif
+
+/* the lid events are delivered by the ACPI button driver */
+#if defined(CONFIG_ACPI_BUTTON) || defined(CONFIG_ACPI_BUTTON_MODULE)
+#   define LID_EVENTS_SUPPORT
+#endif
+
+/* the brightness profiles of the power sources */
+#if (defined(CONFIG_POWER_SUPPLY) || defined(CONFIG_POWER_SUPPLY_MODULE)) && \
+    defined(CONFIG_AMILO_PA2548_PLATFORM_ATTR)
+#   define PROFILES_SUPPORT
+#endif
+
+/* the driver exports the debug files */
+#if defined(CONFIG_DEBUG_FS) && defined(CONFIG_AMILO_PA2548_DEBUGFS)
+#   define DEBUGFS_SUPPORT
+#endif
+
 /*****************************************************************************
  * Defines
  *****************************************************************************/
@@ -123,6 +351,9 @@
 #define ACPI_VIDEO_NOTIFY_INC_BRIGHTNESS     0x86
 #define ACPI_VIDEO_NOTIFY_DEC_BRIGHTNESS     0x87
 
+#define ACPI_AC_ADAPTER_CLASS                "ac_adapter"
+#define ACPI_VIDEO_DEVICE_CLASS              "video"
+
 #define IO_PORT_LED_ADDRESS                  0x14cb
 
 #define IO_PORT_ADDRESS_SET                  0x72
@@ -130,6 +361,33 @@
 
 #define BRTS_REGISTER_ADDRESS                0xF3
 
+#define EC_BATCH_MAX                         32
+#define EC_AUTOINCREMENT_CHECKS              4
+
+#define TRACE_RECORDS_DEFAULT                1024
+#define TRACE_RECORDS_MIN                    16
+#define TRACE_RECORDS_MAX                    32768
+
+#define PREFETCH_WAIT_MS                     100
+
+#define STATS_LATENCY_BUCKETS                18    /* 1us .. 65536us, +Inf */
+#define RESIDENCY_STATES                     8     /* the levels 0..7 */
+
+#define WATCHDOG_WINDOW                      16
+#define WATCHDOG_GOOD_PROBES                 3
+
+#define THROTTLE_WRITERS                     8
+
+#define DISPLAY_OFF_BLANK                    0x01  /* blanked, dimmed to min */
+#define DISPLAY_OFF_LID                      0x02  /* the lid is closed */
+
+#define FEATURE_HOTKEY_LATENCY               0x01
+#define FEATURE_TRACE                        0x02
+#define FEATURE_WATCHDOG                     0x04
+
+/* the disabled features cost one predicted branch in the hot paths */
+#define feature_enabled(f)          unlikely(ACCESS_ONCE(features) & (f))
+
 #define kfree_s(x)                  if (x) { kfree(x); x = NULL; }
 #define safe_do(p,a)                if (p) { a; }
 
@@ -149,58 +407,393 @@ struct options_t
     int min_blevel;   /**< The min brightness level */
 };
 
+/** 
+ * @brief The backends which set a brightness level
+ */
+enum BACKEND
+{
+    BACKEND_ACPI = 0,   /**< The AML method _BCM */
+    BACKEND_NATIVE,     /**< The EC register BRTS_REGISTER_ADDRESS */
+    BACKEND_END
+};
+
+/** 
+ * @brief The latency watchdog of the backends
+ *
+ * It keeps the last latencies of every backend. When the percentile of the
+ * preferred backend exceeds the threshold the other one is used, and the
+ * preferred one is probed periodically until it is fast again. The first
+ * write of the other backend is read back from the EC register, if it did
+ * not take effect the preferred backend is used again for good.
+ */
+struct watchdog_t
+{
+    /** The last latencies of every backend in us */
+    s64 latency[BACKEND_END][WATCHDOG_WINDOW];
+    unsigned int count[BACKEND_END];    /**< The number of kept latencies */
+    unsigned int next[BACKEND_END];     /**< The index of the next latency */
+    enum BACKEND preferred;             /**< The backend chosen by the user */
+    unsigned int good_probes;           /**< The successive fast probes */
+    /** The first write after the failover is read back */
+    int verify;
+    /** The other backend did not set the level, it is not used any more */
+    int failover_broken;
+    struct delayed_work probe;          /**< Probes the preferred backend */
+};
+
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
+
+/** 
+ * @brief The token bucket of a writer of lcd_level
+ */
+struct throttle_writer_t
+{
+    uid_t uid;                  /**< The writer */
+    int used;                   /**< Whether the slot is used */
+    long tokens;                /**< The tokens multiplied by HZ */
+    unsigned long stamp;        /**< The jiffies of the last refill */
+    unsigned long admitted;     /**< The executed writes */
+    unsigned long throttled;    /**< The writes folded into the latest one */
+};
+
+/** 
+ * @brief The admission control of the lcd_level writes
+ *
+ * Every writer (uid) has a bucket of write_burst tokens which is refilled
+ * by write_rate tokens per second, a write takes a token. A write without
+ * a token is not executed, its level replaces the folded one, which is set
+ * by the work when the writer has a token again. The least recently seen
+ * writer gives its slot to a new one.
+ *
+ * There is one brightness level, so there is one folded level for all the
+ * writers: a later write of any writer, folded or executed, supersedes the
+ * folded one, and the folded level is charged to the writer who wrote it
+ * last.
+ */
+struct throttle_t
+{
+    spinlock_t lock;            /**< Protects the writers and the folded level */
+    struct throttle_writer_t writers[THROTTLE_WRITERS];
+    int folded_blevel;          /**< The latest throttled level of all the
+                                     writers, -1 - none */
+    uid_t folded_uid;           /**< The writer of the folded level */
+    struct delayed_work work;   /**< Sets the folded level */
+};
+
+#endif
+
+/** 
+ * @brief A batched read of the EC registers
+ *
+ * The caller fills the registers in any order, possibly repeated, and gets
+ * the values in the same order, all read in one locked transaction.
+ */
+struct ec_batch_t
+{
+    unsigned int count;             /**< The number of the registers */
+    u8 regs[EC_BATCH_MAX];          /**< The registers */
+    u8 values[EC_BATCH_MAX];        /**< The read values */
+    ktime_t stamp;                  /**< The time of the transaction */
+};
+
+/** 
+ * @brief The power sources which have the brightness profiles
+ */
+enum PROFILE
+{
+    PROFILE_AC = 0,         /**< The AC adapter is online */
+    PROFILE_BATTERY,        /**< The system runs on battery */
+    PROFILE_END
+};
+
+/** 
+ * @brief The ways to apply the brightness profile
+ */
+enum PROFILE_MODE
+{
+    PROFILE_MODE_TARGET = 0,    /**< The level is set on the switch */
+    PROFILE_MODE_CEILING,       /**< The level is the highest one */
+    PROFILE_MODE_END
+};
+
 /** 
  * @brief The structure of the global object
+ *
+ * The fields are grouped by the access: the lock with the level state it
+ * protects, the state of the optional features and the devices touched only
+ * at the loading and unloading. Every brightness access but a cache hit
+ * takes the lock, so the lock and the state written under it share one cache
+ * line and a write dirties only that line; the feature state written on
+ * other CPUs without the lock starts on its own line.
  */
 struct amilo_pa2548_t
 {
+    /* The hot state, it is read and written under the lock */
+
+    /** Serializes the brightness access: the state below, the index/data
+     *  port sequence and the _BCM evaluation */
+    struct mutex lock ____cacheline_aligned_in_smp;
+    /** Publishes current_blevel, generation, cache_valid and display_off to
+     *  the cache hits, which do not take the lock; it is written under it */
+    seqcount_t seq;
+    /** The current brightness level */
+    int current_blevel;
+    /** The generation of the brightness level, it is incremented on every
+     *  change */
+    unsigned int generation;
+    /** Whether current_blevel is the hardware level */
+    int cache_valid;
+    /** Why the display is off (DISPLAY_OFF_*) */
+    int display_off;
+    /** The level which is set when the display is on again (-1 - none) */
+    int pending_blevel;
+    enum BACKEND backend; /**< The backend which sets a brightness level */
+    /** The brightness policy */
+    struct amilo_pa2548_policy *policy;
+
+    /* The state of the optional features */
+
+    /** Runs all the deferred work of the driver on the housekeeping CPUs */
+    struct workqueue_struct *wq ____cacheline_aligned_in_smp;
+
+    /** The latency watchdog of the backends, it is changed under the lock */
+    struct watchdog_t watchdog;
+
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
+    /** The admission control of the lcd_level writes */
+    struct throttle_t throttle ____cacheline_aligned_in_smp;
+#endif
+
+#ifdef PROFILES_SUPPORT
+    /** The levels of the power sources (-1 - no profile), they are changed
+     *  under the lock */
+    int profile_level[PROFILE_END];
+    enum PROFILE_MODE profile_mode;     /**< How the profiles are applied */
+    int on_ac;                          /**< The power source, -1 unknown */
+    struct work_struct profile_work;    /**< Applies the profile */
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_LED
+    /** The LED brightness which is written by led_work, it is set without
+     *  the lock from the LED trigger context */
+    enum led_brightness led_brightness;
+    /** Writes the LED brightness out of the LED trigger context */
+    struct work_struct led_work;
+#endif
+
+    /** Whether the cache is being refilled, it is changed under the lock */
+    int prefetching;
+    /** Refills the cache after the invalidation */
+    struct work_struct prefetch_work;
+    /** Completed when the cache is refilled */
+    struct completion prefetched;
+
+    /* The cold state */
+
     /** The backlight device */
-    struct backlight_device *bl_device;
+    struct backlight_device *bl_device ____cacheline_aligned_in_smp;
     /** The platform device */
     struct platform_device *pf_device;
     
-#ifndef KERNEL_ALREADY_HAS_IT
+#ifdef HOTKEYS_SUPPORT
     /** ACPI device */
     struct acpi_device *driver_device;
     /** Input device */
     struct input_dev *input;
+    char input_phys[32];  /**< The path of the input device */
 #endif
 
-    /** The available model options */
-    struct options_t options;
-    
-#ifndef KERNEL_ALREADY_HAS_IT
-    char input_phys[32];  /**< The path of the input device */
+    /** Whether the events which invalidate the cache are delivered */
+    int cache_events;
+    /** Whether the ACPI events notifier is registered */
+    int acpi_events;
+
+#ifdef DEBUGFS_SUPPORT
+    /** The debugfs directory of the driver */
+    struct dentry *debugfs_dir;
+#endif
+};
+
+#ifdef HOTKEYS_SUPPORT
+
+/** 
+ * @brief The stages of the hotkey handling
+ */
+enum HOTKEY_STAGE
+{
+    HOTKEY_STAGE_NOTIFY = 0,    /**< Entry to the notify handler */
+    HOTKEY_STAGE_HW_WRITE,      /**< The brightness level is written */
+    HOTKEY_STAGE_PROC_EVENT,    /**< The proc event is generated */
+    HOTKEY_STAGE_INPUT_SYNC,    /**< The input event is delivered */
+    HOTKEY_STAGE_END
+};
+
+/** 
+ * @brief The hotkey latency statistics
+ *
+ * Every stage keeps a latency from the previous one, the stage
+ * HOTKEY_STAGE_NOTIFY keeps the total latency of the handling.
+ */
+struct hotkey_latency_t
+{
+    spinlock_t lock;                /**< Protects the statistics */
+    u64 samples;                    /**< The number of handled hotkeys */
+    s64 last[HOTKEY_STAGE_END];     /**< The last latency in ns */
+    s64 min[HOTKEY_STAGE_END];      /**< The min latency in ns */
+    s64 max[HOTKEY_STAGE_END];      /**< The max latency in ns */
+    s64 sum[HOTKEY_STAGE_END];      /**< The sum of latencies in ns */
+};
+
+#endif
+
+#ifdef DEBUGFS_SUPPORT
+
+/** 
+ * @brief The recorder of the entry point calls
+ *
+ * The records are kept in a ring which is allocated once at the driver
+ * loading, so the recording never calls the allocator. The new records are
+ * dropped and counted when the ring is full until the trace is read.
+ */
+struct trace_recorder_t
+{
+    spinlock_t lock;        /**< Protects the recorder */
+    u32 dropped;            /**< The number of dropped records */
+    unsigned int head;      /**< The index of the oldest record */
+    unsigned int count;     /**< The number of records in the ring */
+    unsigned int size;      /**< The size of the ring, a power of two */
+    /** The ring of records */
+    struct amilo_pa2548_trace_record *records;
+};
+
 #endif
-    int current_blevel;   /**< The current brightness level */
+
+#ifdef CONFIG_AMILO_PA2548_STATS
+
+/** 
+ * @brief The counters of the driver statistics
+ */
+enum STATS_COUNTER
+{
+    STATS_READS = 0,    /**< The hardware reads of the brightness level */
+    STATS_WRITES,       /**< The hardware writes of the brightness level */
+    STATS_NOTIFIES,     /**< The handled ACPI notifications */
+    STATS_ERRORS,       /**< The failed hardware reads and writes */
+    STATS_FAILOVERS,    /**< The switches to the other backend */
+    STATS_CACHE_HITS,   /**< The reads served from the cache */
+    STATS_INVALIDATIONS,/**< The events which invalidated the cache */
+    STATS_ELIDED,       /**< The profile writes of the level already set */
+    STATS_PARKED,       /**< The writes postponed while the display is off */
+    STATS_THROTTLED,    /**< The lcd_level writes folded by the throttle */
+    STATS_END
+};
+
+/** 
+ * @brief The driver statistics
+ *
+ * The latency of the brightness writes is kept as a histogram, the bucket
+ * i counts the writes which took at most 2^i microseconds, the last bucket
+ * counts the rest.
+ *
+ * Every CPU has its own copy, so the accounting does not share a cache line
+ * between the CPUs. The file sums them up.
+ */
+struct stats_t
+{
+    u64 counters[STATS_END];        /**< The counters */
+    /** The histogram of the write latency */
+    u64 latency_buckets[STATS_LATENCY_BUCKETS];
+    u64 latency_sum_ns;             /**< The sum of the write latencies */
+};
+
+/** 
+ * @brief The modes of the 'silentmode' LED
+ */
+enum LED_MODE
+{
+    LED_MODE_OFF = 0,
+    LED_MODE_HALF,
+    LED_MODE_FULL,
+    LED_MODE_END
 };
 
+/** 
+ * @brief The time spent in every state (the brightness level or the LED
+ * mode), it is accounted on the transitions
+ */
+struct residency_t
+{
+    int state;                      /**< The current state, -1 if unknown */
+    ktime_t since;                  /**< The time of the last transition */
+    u64 ns[RESIDENCY_STATES];       /**< The time spent in every state */
+};
+
+#endif
+
 /*****************************************************************************
  * Prototypes
  *****************************************************************************/
 
 static int dmi_setup_opts_to_amilo_pa_2548(const struct dmi_system_id *dsid);
 
-static int lcd_set_blevel(int level);
 static int lcd_get_blevel(int *level);
+static int lcd_request_blevel(int source, int level);
+static int pf_resume(struct platform_device *device);
+#ifdef HOTKEYS_SUPPORT
+static int lcd_step_blevel(int step);
+#endif
 
+#ifdef CONFIG_AMILO_PA2548_BACKLIGHT
 static int bl_get_blevel(struct backlight_device *bd);
 static int bl_set_blevel(struct backlight_device *bd);
+#endif
 
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
 static ssize_t pf_show_lcd_level(struct device *dev,
                                  struct device_attribute *attr, char *buf);
 static ssize_t pf_store_lcd_level(struct device *dev,
                                   struct device_attribute *attr,
                                   const char *buf, size_t count);
-#ifndef KERNEL_ALREADY_HAS_IT
+static ssize_t pf_show_throttle(struct device *dev,
+                                struct device_attribute *attr, char *buf);
+static ssize_t pf_show_lcd_state(struct device *dev,
+                                 struct device_attribute *attr, char *buf);
+static ssize_t pf_store_lcd_state(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count);
+#endif
+#ifdef PROFILES_SUPPORT
+static ssize_t pf_show_profile_level(struct device *dev,
+                                     struct device_attribute *attr, char *buf);
+static ssize_t pf_store_profile_level(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count);
+static ssize_t pf_show_profile_mode(struct device *dev,
+                                    struct device_attribute *attr, char *buf);
+static ssize_t pf_store_profile_mode(struct device *dev,
+                                     struct device_attribute *attr,
+                                     const char *buf, size_t count);
+#endif
+#ifdef CONFIG_AMILO_PA2548_STATS
+static ssize_t pf_show_stats(struct device *dev,
+                             struct device_attribute *attr, char *buf);
+static ssize_t pf_show_residency(struct device *dev,
+                                 struct device_attribute *attr, char *buf);
+static ssize_t pf_store_residency(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count);
+#endif
+#ifdef HOTKEYS_SUPPORT
 static int acpi_driver_add(struct acpi_device *device);
 static int acpi_driver_remove(struct acpi_device *device, int type);
 static void acpi_driver_notify(struct acpi_device *device, u32 event);
 #endif
 
+#ifdef CONFIG_AMILO_PA2548_LED
 static enum led_brightness led_sm_brightness_get(struct led_classdev *device);
 static void led_sm_brightness_set(struct led_classdev *device,
                                   enum led_brightness brightness);
+#endif
 
 /*****************************************************************************
  * Initialized variables
@@ -209,119 +802,404 @@ static void led_sm_brightness_set(struct led_classdev *device,
 /** 
  * @brief The global object of this module
  */
-static struct amilo_pa2548_t *this_laptop = NULL;
+static struct amilo_pa2548_t *this_laptop __read_mostly = NULL;
 
 /** 
- * @brief The option indexes of the supported models
+ * @brief The options of the detected model, they are set at the loading
  */
-enum OPTIONS_IDX
-{
-    MODEL_AMILO_PA_2548 = 0,
-    MODEL_END
-};
+static struct options_t laptop_options __read_mostly;
 
 /** 
- * @brief The model options
+ * @brief The enabled optional features (FEATURE_*)
  */
-static const struct options_t __initdata model_options[MODEL_END] = {
-    /* The options for model Amilo Pa 2548 */
-    {
-        .name = "Amilo Pa 2548",
-        .BCL = "\\_SB.PCI0.XVR0.VGA.LCD._BCL",
-        .BCM = "\\_SB.PCI0.XVR0.VGA.LCD._BCM",
-        .max_blevel = 7,
-        .min_blevel = 0,
-    },
-};
+static unsigned int features __read_mostly = 0;
+module_param(features, uint, 0644);
+MODULE_PARM_DESC(features, "Optional features: 0x01 - hotkey latency, "
+                 "0x02 - entry point trace, 0x04 - backend watchdog");
 
 /** 
- * @brief The DMI whitelist of the supported models
+ * @brief The name of the backend which sets a brightness level
  */
-static const struct dmi_system_id __initdata dmi_vip_table[] = {
-    {
-        .ident = "Amilo Pa 2548",
-        .matches = {
-            DMI_MATCH(DMI_SYS_VENDOR, AMILO_PA2548_VENDOR),
-            DMI_MATCH(DMI_PRODUCT_NAME, "AMILO Pa 2548")
-        },
-        .callback = dmi_setup_opts_to_amilo_pa_2548
-    },
-    {}
-};
+static char backend_name[8] = "acpi";
+module_param_string(backend, backend_name, sizeof(backend_name), 0444);
+MODULE_PARM_DESC(backend, "The brightness backend: acpi (_BCM) or native "
+                 "(EC register)");
 
 /** 
- * @brief The backlight options
- *
- * @ingroup backlightgroup
+ * @brief The step of the brightness level on the Fn-keys
  */
-static struct backlight_ops bl_opts = {
-    .get_brightness = bl_get_blevel,
-    .update_status = bl_set_blevel
-};
+static int hotkey_step __read_mostly = 1;
+module_param(hotkey_step, int, 0644);
+MODULE_PARM_DESC(hotkey_step, "The brightness step of the Fn-keys");
 
-static DEVICE_ATTR(lcd_level, 0666, pf_show_lcd_level, pf_store_lcd_level);
+/** 
+ * @brief The ceiling of the brightness level
+ */
+static int max_level __read_mostly = -1;
+module_param(max_level, int, 0644);
+MODULE_PARM_DESC(max_level, "The highest brightness level which is set "
+                 "(-1 - no ceiling)");
 
 /** 
- * @brief The platform specific attributes
- * 
- * @ingroup platformgroup
+ * @brief The backend latency which makes the watchdog switch the backend
  */
-static struct attribute *pf_attributes[] = {
-    &dev_attr_lcd_level.attr,
-    NULL
-};
+static unsigned int watchdog_threshold_us __read_mostly = 10000;
+module_param(watchdog_threshold_us, uint, 0644);
+MODULE_PARM_DESC(watchdog_threshold_us, "The backend latency (us) which "
+                 "makes the watchdog switch to the other backend");
 
 /** 
- * @brief The platform specific group attributes
- *
- * @ingroup platformgroup
+ * @brief The percentile of the backend latency checked by the watchdog
  */
-static struct attribute_group pf_attribute_group = {
-    .attrs = pf_attributes
-};
+static unsigned int watchdog_percentile __read_mostly = 90;
+module_param(watchdog_percentile, uint, 0644);
+MODULE_PARM_DESC(watchdog_percentile, "The percentile of the last backend "
+                 "latencies which is compared with the threshold");
 
 /** 
- * @brief The platform driver data
- *
- * @ingroup platformgroup
+ * @brief The period of probing the preferred backend after the switch
  */
-static struct platform_driver pf_driver = {
-    .driver = {
-        .name = AMILO_PA2548_SYSTEM_NAME,
-        .owner = THIS_MODULE
-    }
-};
+static unsigned int watchdog_probe_ms __read_mostly = 30000;
+module_param(watchdog_probe_ms, uint, 0644);
+MODULE_PARM_DESC(watchdog_probe_ms, "The period (ms) of probing the preferred "
+                 "backend after the switch");
 
-#ifndef KERNEL_ALREADY_HAS_IT
+/** 
+ * @brief Whether the brightness level is read from the cache
+ */
+static int cache_level __read_mostly = 0;
+module_param(cache_level, bool, 0644);
+MODULE_PARM_DESC(cache_level, "Read the brightness level from the cache "
+                 "which is revalidated after the AC adapter, lid and video "
+                 "events");
 
-/**
- * @brief IDs of ACPI device
- *
- * @ingroup acpidrivergroup
+/** 
+ * @brief The CPUs which run the deferred work and the timers of the driver
  */
-static const struct acpi_device_id acpi_driver_device_ids[] = {
-    {AMILO_PA2548_ACPI_DRIVER_HID, 0},
-    {"", 0},
-};
+static char housekeeping_cpus[64] = "";
+module_param_string(housekeeping_cpus, housekeeping_cpus,
+                    sizeof(housekeeping_cpus), 0444);
+MODULE_PARM_DESC(housekeeping_cpus, "The list of the CPUs which run the work "
+                 "and the timers of the driver, e.g. \"0-1\" (default all)");
 
-/**
- * @brief The ACPI driver specific options
- *
- * @ingroup acpidrivergroup
+/** 
+ * @brief The parsed housekeeping_cpus
  */
-static struct acpi_driver acpi_amilo_pa2548_driver = {
-    .name = AMILO_PA2548_DRIVER_NAME,
-    .class = AMILO_PA2548_DRIVER_CLASS,
-    .ids = acpi_driver_device_ids,
-    .ops = {
-        .add = acpi_driver_add,
-        .remove = acpi_driver_remove,
-        .notify = acpi_driver_notify,
+static struct cpumask housekeeping_mask __read_mostly;
+
+/** 
+ * @brief Whether the EC index port is incremented after the data read
+ */
+static int ec_autoincrement __read_mostly = 0;
+module_param(ec_autoincrement, bool, 0644);
+MODULE_PARM_DESC(ec_autoincrement, "The EC increments the register index "
+                 "after every data read, the batched reads skip the index "
+                 "writes of the sequential registers");
+
+/** 
+ * @brief Whether ec_autoincrement holds for this EC: 0 - not verified yet,
+ * 1 - verified, -1 - the EC does not increment the index; it is changed
+ * under the lock
+ */
+static int ec_autoincrement_verified;
+
+/** 
+ * @brief The checked batched reads which agreed and which disagreed with
+ * the indexed ones, they are changed under the lock
+ */
+static unsigned int ec_autoincrement_agreed, ec_autoincrement_disagreed;
+
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
+/** 
+ * @brief The rate of the lcd_level writes of every writer
+ */
+static unsigned int write_rate __read_mostly = 0;
+module_param(write_rate, uint, 0644);
+MODULE_PARM_DESC(write_rate, "The lcd_level writes per second of every user "
+                 "(0 - unlimited), the excess writes are folded into the "
+                 "latest one");
+
+/** 
+ * @brief The burst of the lcd_level writes of every writer
+ */
+static unsigned int write_burst __read_mostly = 10;
+module_param(write_burst, uint, 0644);
+MODULE_PARM_DESC(write_burst, "The lcd_level writes of every user which are "
+                 "executed at once before the rate limit");
+#endif
+
+static int default_policy_on_hotkey(int delta, int cur);
+static int default_policy_on_request(int source, int level);
+static int default_policy_clamp(int level);
+
+/** 
+ * @brief The default brightness policy
+ */
+static struct amilo_pa2548_policy default_policy = {
+    .name = "default",
+    .on_hotkey = default_policy_on_hotkey,
+    .on_request = default_policy_on_request,
+    .clamp = default_policy_clamp,
+};
+
+/** 
+ * @brief The names of the backends
+ */
+static const char *backend_names[BACKEND_END] = {
+    [BACKEND_ACPI] = "acpi",
+    [BACKEND_NATIVE] = "native",
+};
+
+#ifdef HOTKEYS_SUPPORT
+/** 
+ * @brief The latency statistics of the hotkey handling
+ */
+static struct hotkey_latency_t hotkey_latency = {
+    .lock = __SPIN_LOCK_UNLOCKED(hotkey_latency.lock),
+};
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_STATS
+/** 
+ * @brief The driver statistics of every CPU
+ */
+static DEFINE_PER_CPU(struct stats_t, stats);
+
+/** 
+ * @brief The names of the counters in the statistics file
+ */
+static const char *stats_counter_names[STATS_END] = {
+    [STATS_READS] = "reads",
+    [STATS_WRITES] = "writes",
+    [STATS_NOTIFIES] = "notifies",
+    [STATS_ERRORS] = "errors",
+    [STATS_FAILOVERS] = "failovers",
+    [STATS_CACHE_HITS] = "cache_hits",
+    [STATS_INVALIDATIONS] = "invalidations",
+    [STATS_ELIDED] = "elided_writes",
+    [STATS_PARKED] = "parked_writes",
+    [STATS_THROTTLED] = "throttled_writes",
+};
+
+/** 
+ * @brief Protects the residency of the levels and the LED modes
+ */
+static DEFINE_SPINLOCK(residency_lock);
+
+/** 
+ * @brief The time spent at every brightness level
+ */
+static struct residency_t level_residency = { .state = -1 };
+
+#ifdef CONFIG_AMILO_PA2548_LED
+/** 
+ * @brief The time spent in every mode of the 'silentmode' LED
+ */
+static struct residency_t led_residency = { .state = -1 };
+
+/** 
+ * @brief The names of the LED modes in the residency file
+ */
+static const char *led_mode_names[LED_MODE_END] = {
+    [LED_MODE_OFF] = "off",
+    [LED_MODE_HALF] = "half",
+    [LED_MODE_FULL] = "full",
+};
+#endif
+#endif
+
+#ifdef DEBUGFS_SUPPORT
+/** 
+ * @brief The recorder of the entry point calls
+ */
+static struct trace_recorder_t trace_recorder = {
+    .lock = __SPIN_LOCK_UNLOCKED(trace_recorder.lock),
+};
+
+/** 
+ * @brief The number of records preallocated for the trace
+ */
+static unsigned int trace_records = TRACE_RECORDS_DEFAULT;
+module_param(trace_records, uint, 0444);
+MODULE_PARM_DESC(trace_records, "The number of preallocated trace records");
+#endif
+
+/** 
+ * @brief The option indexes of the supported models
+ */
+enum OPTIONS_IDX
+{
+    MODEL_AMILO_PA_2548 = 0,
+    MODEL_END
+};
+
+/** 
+ * @brief The model options
+ */
+static const struct options_t __initdata model_options[MODEL_END] = {
+    /* The options for model Amilo Pa 2548 */
+    {
+        .name = "Amilo Pa 2548",
+        .BCL = "\\_SB.PCI0.XVR0.VGA.LCD._BCL",
+        .BCM = "\\_SB.PCI0.XVR0.VGA.LCD._BCM",
+        .max_blevel = 7,
+        .min_blevel = 0,
+    },
+};
+
+/** 
+ * @brief The DMI whitelist of the supported models
+ */
+static const struct dmi_system_id __initdata dmi_vip_table[] = {
+    {
+        .ident = "Amilo Pa 2548",
+        .matches = {
+            DMI_MATCH(DMI_SYS_VENDOR, AMILO_PA2548_VENDOR),
+            DMI_MATCH(DMI_PRODUCT_NAME, "AMILO Pa 2548")
+        },
+        .callback = dmi_setup_opts_to_amilo_pa_2548
+    },
+    {}
+};
+
+#ifdef CONFIG_AMILO_PA2548_BACKLIGHT
+
+/** 
+ * @brief The backlight options
+ *
+ * @ingroup backlightgroup
+ */
+static struct backlight_ops bl_opts = {
+    .get_brightness = bl_get_blevel,
+    .update_status = bl_set_blevel
+};
+
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
+
+static DEVICE_ATTR(lcd_level, 0666, pf_show_lcd_level, pf_store_lcd_level);
+static DEVICE_ATTR(throttle, 0444, pf_show_throttle, NULL);
+static DEVICE_ATTR(lcd_state, 0666, pf_show_lcd_state, pf_store_lcd_state);
+#ifdef PROFILES_SUPPORT
+static DEVICE_ATTR(ac_level, 0644, pf_show_profile_level,
+                   pf_store_profile_level);
+static DEVICE_ATTR(battery_level, 0644, pf_show_profile_level,
+                   pf_store_profile_level);
+static DEVICE_ATTR(profile_mode, 0644, pf_show_profile_mode,
+                   pf_store_profile_mode);
+
+/** 
+ * @brief The names of the profile modes
+ * 
+ * @ingroup platformgroup
+ */
+static const char *profile_mode_names[PROFILE_MODE_END] = {
+    [PROFILE_MODE_TARGET] = "target",
+    [PROFILE_MODE_CEILING] = "ceiling",
+};
+#endif
+
+/** 
+ * @brief The platform specific attributes
+ * 
+ * @ingroup platformgroup
+ */
+static struct attribute *pf_attributes[] = {
+    &dev_attr_lcd_level.attr,
+    &dev_attr_throttle.attr,
+    &dev_attr_lcd_state.attr,
+#ifdef PROFILES_SUPPORT
+    &dev_attr_ac_level.attr,
+    &dev_attr_battery_level.attr,
+    &dev_attr_profile_mode.attr,
+#endif
+    NULL
+};
+
+/** 
+ * @brief The platform specific group attributes
+ *
+ * @ingroup platformgroup
+ */
+static struct attribute_group pf_attribute_group = {
+    .attrs = pf_attributes
+};
+
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_STATS
+
+static DEVICE_ATTR(stats, 0444, pf_show_stats, NULL);
+static DEVICE_ATTR(residency, 0644, pf_show_residency, pf_store_residency);
+
+/** 
+ * @brief The statistics attributes
+ * 
+ * @ingroup statsgroup
+ */
+static struct attribute *stats_attributes[] = {
+    &dev_attr_stats.attr,
+    &dev_attr_residency.attr,
+    NULL
+};
+
+/** 
+ * @brief The statistics group attributes
+ *
+ * @ingroup statsgroup
+ */
+static struct attribute_group stats_attribute_group = {
+    .attrs = stats_attributes
+};
+
+#endif
+
+/** 
+ * @brief The platform driver data
+ *
+ * @ingroup platformgroup
+ */
+static struct platform_driver pf_driver = {
+    .driver = {
+        .name = AMILO_PA2548_SYSTEM_NAME,
+        .owner = THIS_MODULE
+    },
+    .resume = pf_resume,
+};
+
+#ifdef HOTKEYS_SUPPORT
+
+/**
+ * @brief IDs of ACPI device
+ *
+ * @ingroup acpidrivergroup
+ */
+static const struct acpi_device_id acpi_driver_device_ids[] = {
+    {AMILO_PA2548_ACPI_DRIVER_HID, 0},
+    {"", 0},
+};
+
+/**
+ * @brief The ACPI driver specific options
+ *
+ * @ingroup acpidrivergroup
+ */
+static struct acpi_driver acpi_amilo_pa2548_driver = {
+    .name = AMILO_PA2548_DRIVER_NAME,
+    .class = AMILO_PA2548_DRIVER_CLASS,
+    .ids = acpi_driver_device_ids,
+    .ops = {
+        .add = acpi_driver_add,
+        .remove = acpi_driver_remove,
+        .notify = acpi_driver_notify,
     },
 };
 
 #endif
 
+#ifdef CONFIG_AMILO_PA2548_LED
+
 /**
  * @brief The LED device specific options
  *
@@ -333,400 +1211,2858 @@ static struct led_classdev amilo_pa2548_sm_led = {
     .brightness_set = led_sm_brightness_set
 };
 
+#endif
+
 /*****************************************************************************
  * Implementation
  *****************************************************************************/
 
 /** 
- * @brief Initializes options for model FSC Amilo Pa 2548
- *
- * @param dsid The DMI system identificator
- *
- * @return Always the normal status
+ * @brief Initializes options for model FSC Amilo Pa 2548
+ *
+ * @param dsid The DMI system identificator
+ *
+ * @return Always the normal status
+ */
+static int dmi_setup_opts_to_amilo_pa_2548(const struct dmi_system_id *dsid)
+{
+    laptop_options = model_options[MODEL_AMILO_PA_2548];
+
+    return 0;
+}
+
+/** 
+ * @brief Parses the housekeeping CPUs, all CPUs if they are not given or
+ * none of them is online
+ */
+static void __init housekeeping_init(void)
+{
+    if (housekeeping_cpus[0] != '\0' &&
+        cpulist_parse(housekeeping_cpus, &housekeeping_mask) == 0 &&
+        cpumask_intersects(&housekeeping_mask, cpu_online_mask))
+        return;
+
+    if (housekeeping_cpus[0] != '\0')
+        printk(KERN_WARNING AMILO_PA2548_PREFIX
+               "no online CPU in housekeeping_cpus '%s', using all\n",
+               housekeeping_cpus);
+
+    cpumask_copy(&housekeeping_mask, cpu_possible_mask);
+}
+
+/** 
+ * @brief Chooses the CPU of the deferred work: the current one if it is a
+ * housekeeping CPU, otherwise any online housekeeping CPU
+ *
+ * @return The CPU
+ */
+static int housekeeping_cpu(void)
+{
+    int cpu = raw_smp_processor_id();
+
+    if (likely(cpumask_test_cpu(cpu, &housekeeping_mask)))
+        return cpu;
+
+    cpu = cpumask_any_and(&housekeeping_mask, cpu_online_mask);
+
+    return (cpu < nr_cpu_ids) ? cpu : raw_smp_processor_id();
+}
+
+/** 
+ * @brief Queues the work of the driver on a housekeeping CPU
+ *
+ * @param work The work
+ */
+static void driver_queue_work(struct work_struct *work)
+{
+    queue_work_on(housekeeping_cpu(), this_laptop->wq, work);
+}
+
+/** 
+ * @brief Queues the delayed work of the driver, its timer is armed on a
+ * housekeeping CPU too
+ *
+ * @param work The work
+ * @param delay The delay in jiffies
+ */
+static void driver_queue_delayed_work(struct delayed_work *work,
+                                      unsigned long delay)
+{
+    queue_delayed_work_on(housekeeping_cpu(), this_laptop->wq, work, delay);
+}
+
+#ifdef DEBUGFS_SUPPORT
+
+/** 
+ * @brief Records a call of the entry point with two arguments if the
+ * recording is enabled
+ *
+ * @param entry The entry point (AMILO_PA2548_TRACE_*)
+ * @param arg The first argument of the call
+ * @param value The last argument of the call
+ */
+static void trace_record_arg(u8 entry, s16 arg, s32 value)
+{
+    struct trace_recorder_t *recorder = &trace_recorder;
+    struct amilo_pa2548_trace_record *record;
+    unsigned long flags;
+
+    if (!feature_enabled(FEATURE_TRACE))
+        return;
+
+    spin_lock_irqsave(&recorder->lock, flags);
+
+    if (recorder->count == recorder->size)
+    {
+        recorder->dropped++;
+    }
+    else
+    {
+        record = &recorder->records[(recorder->head + recorder->count) &
+                                    (recorder->size - 1)];
+        memset(record, 0, sizeof(*record));
+        record->timestamp = ktime_to_ns(ktime_get());
+        record->entry = entry;
+        record->arg = arg;
+        record->value = value;
+        recorder->count++;
+    }
+
+    spin_unlock_irqrestore(&recorder->lock, flags);
+}
+
+#else
+
+static inline void trace_record_arg(u8 entry, s16 arg, s32 value) {}
+
+#endif
+
+/** 
+ * @brief Records a call of the entry point if the recording is enabled
+ *
+ * @param entry The entry point (AMILO_PA2548_TRACE_*)
+ * @param value The argument of the call
+ */
+static inline void trace_record(u8 entry, s32 value)
+{
+    trace_record_arg(entry, 0, value);
+}
+
+#ifdef CONFIG_AMILO_PA2548_STATS
+
+/** 
+ * @brief Increments the counter of the statistics
+ *
+ * @param counter The counter
+ */
+static void stats_count(enum STATS_COUNTER counter)
+{
+    get_cpu_var(stats).counters[counter]++;
+    put_cpu_var(stats);
+}
+
+/** 
+ * @brief Accounts the brightness write
+ *
+ * @param ns The latency of the write
+ * @param failed Whether the write failed
+ */
+static void stats_write(s64 ns, int failed)
+{
+    u64 us = ns > 0 ? ns : 0;
+    struct stats_t *cpu_stats;
+    int bucket;
+
+    do_div(us, 1000);
+    if (us <= 1)
+        bucket = 0;
+    else if (us > (1ULL << (STATS_LATENCY_BUCKETS - 2)))
+        bucket = STATS_LATENCY_BUCKETS - 1;
+    else
+        bucket = ilog2((u32)us - 1) + 1;
+
+    cpu_stats = &get_cpu_var(stats);
+    cpu_stats->counters[STATS_WRITES]++;
+    if (failed)
+        cpu_stats->counters[STATS_ERRORS]++;
+    cpu_stats->latency_buckets[bucket]++;
+    cpu_stats->latency_sum_ns += ns > 0 ? ns : 0;
+    put_cpu_var(stats);
+}
+
+/** 
+ * @brief Accounts the transition to the state
+ *
+ * @param r The residency
+ * @param state The new state
+ */
+static void residency_enter(struct residency_t *r, int state)
+{
+    ktime_t now = ktime_get();
+    unsigned long flags;
+
+    if (state < 0 || state >= RESIDENCY_STATES)
+        return;
+
+    spin_lock_irqsave(&residency_lock, flags);
+    if (r->state != state)
+    {
+        if (r->state >= 0)
+            r->ns[r->state] += ktime_to_ns(ktime_sub(now, r->since));
+        r->state = state;
+        r->since = now;
+    }
+    spin_unlock_irqrestore(&residency_lock, flags);
+}
+
+#else
+
+#define stats_count(counter)        do { } while (0)
+static inline void stats_write(s64 ns, int failed) {}
+#define residency_enter(r, state)   do { } while (0)
+
+#endif
+
+/** 
+ * @brief Sets a brightness level through the AML method _BCM
+ * 
+ * @param level The brightness level
+ * 
+ * @return The ACPI status
+ */
+static acpi_status acpi_set_blevel(int level)
+{
+    union acpi_object arg0 = { ACPI_TYPE_INTEGER };
+    struct acpi_object_list args = { 1, &arg0 };
+
+    arg0.integer.value = level;
+
+    return acpi_evaluate_object(NULL, (char *)laptop_options.BCM, &args,
+                                NULL);
+}
+
+/** 
+ * @brief Reads an EC register through the index/data ports, the caller
+ * holds the lock
+ * 
+ * @param reg The register
+ * @param set_index Whether the index is written, otherwise the EC points
+ * to the register already
+ * @param value The read value
+ * 
+ * @return The ACPI error level
+ */
+static int __ec_read_register(u8 reg, int set_index, u32 *value)
+{
+    int status;
+
+    if (set_index)
+    {
+        status = acpi_os_write_port(IO_PORT_ADDRESS_SET, reg, 1);
+        if (status < 0)
+        {
+            stats_count(STATS_ERRORS);
+            printk(KERN_ERR AMILO_PA2548_PREFIX
+                   "Cannot to write data: %d in port 0x%X\n", reg,
+                   IO_PORT_ADDRESS_SET);
+            return AE_ERROR;
+        }
+    }
+
+    status = acpi_os_read_port(IO_PORT_DATA_RW, value, 1);
+    if (status < 0)
+    {
+        stats_count(STATS_ERRORS);
+        printk(KERN_ERR AMILO_PA2548_PREFIX
+               "Cannot to read data from port: 0x%X\n", IO_PORT_DATA_RW);
+        return AE_ERROR;
+    }
+
+    return AE_OK;
+}
+
+static int ec_reg_cmp(const void *a, const void *b)
+{
+    return (int)*(const u8 *)a - (int)*(const u8 *)b;
+}
+
+/** 
+ * @brief Reads the EC registers of the batch, the caller holds the lock
+ *
+ * Every register is read once in the ascending order. With
+ * ec_autoincrement the index is written only at the gaps, once it is
+ * verified that the EC really increments it.
+ * 
+ * @param batch The batch
+ * 
+ * @return The ACPI error level
+ */
+static int __ec_read_batch(struct ec_batch_t *batch)
+{
+    u8 regs[EC_BATCH_MAX];
+    u8 values[EC_BATCH_MAX] = { 0 };
+    unsigned int count = 0;
+    unsigned int i, j;
+    u8 skipped[EC_BATCH_MAX] = { 0 };
+    int autoincrement = ec_autoincrement && ec_autoincrement_verified >= 0;
+    int any_skipped = 0, agreed = 0, disagreed = 0;
+    int next = -1;
+    u32 value;
+
+    if (batch->count == 0 || batch->count > EC_BATCH_MAX)
+        return AE_ERROR;
+
+    memcpy(regs, batch->regs, batch->count);
+    sort(regs, batch->count, sizeof(regs[0]), ec_reg_cmp, NULL);
+
+    for (i = 0; i < batch->count; ++i)
+        if (count == 0 || regs[count - 1] != regs[i])
+            regs[count++] = regs[i];
+
+    batch->stamp = ktime_get();
+
+    for (i = 0; i < count; ++i)
+    {
+        int set_index = !autoincrement || regs[i] != next;
+
+        value = 0;
+        if (__ec_read_register(regs[i], set_index, &value) != AE_OK)
+            return AE_ERROR;
+
+        values[i] = value;
+        next = regs[i] + 1;
+        skipped[i] = !set_index;
+        any_skipped |= !set_index;
+    }
+
+    /* 
+     * until it is verified, the reads without the index writes are checked
+     * by the indexed ones; a register equal to its neighbour proves nothing
+     * and a telemetry register may change in between, so one read does not
+     * decide
+     */
+    if (any_skipped && ec_autoincrement_verified == 0)
+    {
+        u8 batched[EC_BATCH_MAX];
+
+        memcpy(batched, values, count);
+
+        for (i = 0; i < count; ++i)
+        {
+            value = 0;
+            if (__ec_read_register(regs[i], 1, &value) != AE_OK)
+                return AE_ERROR;
+
+            values[i] = value;
+        }
+
+        for (i = 1; i < count; ++i)
+        {
+            if (!skipped[i])
+                continue;
+
+            if (batched[i] != values[i])
+                disagreed = 1;
+            else if (values[i] != values[i - 1])
+                agreed = 1;
+        }
+
+        if (disagreed)
+            ec_autoincrement_disagreed++;
+        else if (agreed)
+            ec_autoincrement_agreed++;
+
+        if (ec_autoincrement_agreed >= EC_AUTOINCREMENT_CHECKS)
+        {
+            ec_autoincrement_verified = 1;
+        }
+        else if (ec_autoincrement_disagreed >= EC_AUTOINCREMENT_CHECKS)
+        {
+            ec_autoincrement_verified = -1;
+            printk(KERN_WARNING AMILO_PA2548_PREFIX
+                   "The EC does not increment the register index, "
+                   "ec_autoincrement is ignored\n");
+        }
+    }
+
+    for (i = 0; i < batch->count; ++i)
+    {
+        for (j = 0; regs[j] != batch->regs[i]; ++j)
+            ;
+        batch->values[i] = values[j];
+    }
+
+    return AE_OK;
+}
+
+#ifdef DEBUGFS_SUPPORT
+
+/** 
+ * @brief Reads the EC registers of the batch in one locked transaction
+ * 
+ * @param batch The batch
+ * 
+ * @return The ACPI error level
+ */
+static int ec_read_batch(struct ec_batch_t *batch)
+{
+    int status;
+
+    mutex_lock(&this_laptop->lock);
+    status = __ec_read_batch(batch);
+    mutex_unlock(&this_laptop->lock);
+
+    return status;
+}
+
+#endif
+
+/** 
+ * @brief Sets a brightness level through the EC register
+ * 
+ * @param level The brightness level
+ * 
+ * @return The ACPI status
+ */
+static acpi_status native_set_blevel(int level)
+{
+    acpi_status status;
+
+    status = acpi_os_write_port(IO_PORT_ADDRESS_SET, BRTS_REGISTER_ADDRESS, 1);
+    if (ACPI_FAILURE(status))
+        return status;
+
+    return acpi_os_write_port(IO_PORT_DATA_RW, level, 1);
+}
+
+/** 
+ * @brief Sets a brightness level through the backend
+ * 
+ * @param backend The backend
+ * @param level The brightness level
+ * @param latency The latency of the backend in ns
+ * 
+ * @return The ACPI status
+ */
+static acpi_status backend_set_blevel(enum BACKEND backend, int level,
+                                      s64 *latency)
+{
+    acpi_status status;
+    ktime_t start = ktime_get();
+
+    /* direct calls, the backend is the same for the most of the time */
+    if (likely(backend == BACKEND_ACPI))
+        status = acpi_set_blevel(level);
+    else
+        status = native_set_blevel(level);
+
+    *latency = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    return status;
+}
+
+/**
+ * @defgroup watchdoggroup The latency watchdog of the backends
+ * @{
+ */
+
+/** 
+ * @brief Keeps the latency of the backend, the caller holds the lock
+ * 
+ * @param backend The backend
+ * @param latency The latency in ns
+ */
+static void watchdog_add(enum BACKEND backend, s64 latency)
+{
+    struct watchdog_t *wd = &this_laptop->watchdog;
+
+    wd->latency[backend][wd->next[backend]] = div_s64(latency, NSEC_PER_USEC);
+    wd->next[backend] = (wd->next[backend] + 1) % WATCHDOG_WINDOW;
+    if (wd->count[backend] < WATCHDOG_WINDOW)
+        wd->count[backend]++;
+}
+
+/** 
+ * @brief Returns the percentile of the kept latencies of the backend
+ * 
+ * @param backend The backend
+ * 
+ * @return The latency in us or -1 until the window is full
+ */
+static s64 watchdog_percentile_us(enum BACKEND backend)
+{
+    struct watchdog_t *wd = &this_laptop->watchdog;
+    s64 sorted[WATCHDOG_WINDOW], value;
+    unsigned int rank;
+    int i, j;
+
+    if (wd->count[backend] < WATCHDOG_WINDOW)
+        return -1;
+
+    for (i = 0; i < WATCHDOG_WINDOW; ++i)
+    {
+        value = wd->latency[backend][i];
+        for (j = i; j > 0 && sorted[j - 1] > value; --j)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = value;
+    }
+
+    /* the nearest rank */
+    rank = DIV_ROUND_UP(min(watchdog_percentile, 100U) * WATCHDOG_WINDOW, 100);
+
+    return sorted[rank ? rank - 1 : 0];
+}
+
+/** 
+ * @brief Switches the backend after the preferred one became slow, the
+ * caller holds the lock
+ * 
+ * @param backend The backend which wrote the level
+ * @param latency The last latency of the backend in ns
+ */
+static void watchdog_account(enum BACKEND backend, s64 latency)
+{
+    struct watchdog_t *wd = &this_laptop->watchdog;
+    s64 percentile;
+
+    if (!feature_enabled(FEATURE_WATCHDOG))
+        return;
+
+    watchdog_add(backend, latency);
+
+    /* the other backend is kept until the probe switches back */
+    if (backend != wd->preferred || wd->failover_broken)
+        return;
+
+    percentile = watchdog_percentile_us(backend);
+    if (percentile <= watchdog_threshold_us)
+        return;
+
+    this_laptop->backend = (backend == BACKEND_ACPI) ? BACKEND_NATIVE :
+                                                       BACKEND_ACPI;
+    wd->count[backend] = 0;
+    wd->good_probes = 0;
+    wd->verify = 1;
+    stats_count(STATS_FAILOVERS);
+
+    printk(KERN_WARNING AMILO_PA2548_PREFIX
+           "backend %s p%u latency %lld us exceeds %u us, switching to %s\n",
+           backend_names[backend], watchdog_percentile, (long long)percentile,
+           watchdog_threshold_us, backend_names[this_laptop->backend]);
+
+    driver_queue_delayed_work(&wd->probe, msecs_to_jiffies(watchdog_probe_ms));
+}
+
+/** 
+ * @brief Probes the preferred backend and switches back to it after
+ * WATCHDOG_GOOD_PROBES successive fast probes
+ * 
+ * @param work The work
+ */
+static void watchdog_probe(struct work_struct *work)
+{
+    struct watchdog_t *wd = &this_laptop->watchdog;
+    acpi_status status;
+    s64 latency;
+
+    mutex_lock(&this_laptop->lock);
+
+    if (this_laptop->backend == wd->preferred)
+        goto __unlock;
+
+    /* nobody sees the display, probe later */
+    if (this_laptop->display_off)
+    {
+        driver_queue_delayed_work(&wd->probe,
+                                  msecs_to_jiffies(watchdog_probe_ms));
+        goto __unlock;
+    }
+
+    status = backend_set_blevel(wd->preferred, this_laptop->current_blevel,
+                                &latency);
+    latency = div_s64(latency, NSEC_PER_USEC);
+
+    if (ACPI_FAILURE(status) || latency > watchdog_threshold_us)
+        wd->good_probes = 0;
+    else
+        wd->good_probes++;
+
+    if (wd->good_probes < WATCHDOG_GOOD_PROBES)
+    {
+        driver_queue_delayed_work(&wd->probe,
+                                  msecs_to_jiffies(watchdog_probe_ms));
+        goto __unlock;
+    }
+
+    this_laptop->backend = wd->preferred;
+
+    printk(KERN_INFO AMILO_PA2548_PREFIX
+           "backend %s latency %lld us is under %u us again, switching back\n",
+           backend_names[wd->preferred], (long long)latency,
+           watchdog_threshold_us);
+
+__unlock:
+    mutex_unlock(&this_laptop->lock);
+}
+
+/** 
+ * @brief Reads back the first level written by the backend after the
+ * failover, the caller holds the lock
+ *
+ * If the EC register does not have the level the backend does not work on
+ * this machine: the preferred backend sets the level again and is used
+ * from now on, the watchdog only keeps the latencies.
+ * 
+ * @param level The written brightness level
+ * 
+ * @return The ACPI status of the level
+ */
+static acpi_status watchdog_verify(int level)
+{
+    struct watchdog_t *wd = &this_laptop->watchdog;
+    enum BACKEND backend = this_laptop->backend;
+    u32 data = 0;
+    s64 latency;
+
+    wd->verify = 0;
+
+    if (__ec_read_register(BRTS_REGISTER_ADDRESS, 1, &data) == AE_OK &&
+        data == level)
+        return AE_OK;
+
+    this_laptop->backend = wd->preferred;
+    wd->failover_broken = 1;
+    stats_count(STATS_ERRORS);
+
+    printk(KERN_ERR AMILO_PA2548_PREFIX
+           "backend %s did not set level %d (read %u), switching back to %s "
+           "for good\n", backend_names[backend], level, data,
+           backend_names[wd->preferred]);
+
+    return backend_set_blevel(wd->preferred, level, &latency);
+}
+
+/** @} */
+
+/** 
+ * @brief Starts a change of the state seen by the cache hits, the caller
+ * holds the lock
+ *
+ * The preemption is disabled, so the readers do not spin behind a writer
+ * which was scheduled out.
+ */
+static inline void lcd_publish_begin(void)
+{
+    preempt_disable();
+    write_seqcount_begin(&this_laptop->seq);
+}
+
+/** 
+ * @brief Ends a change of the state seen by the cache hits
+ */
+static inline void lcd_publish_end(void)
+{
+    write_seqcount_end(&this_laptop->seq);
+    preempt_enable();
+}
+
+/** 
+ * @brief Sets a brightness level, the caller holds the lock
+ * 
+ * @param level The brightness level in the range 0..7
+ * 
+ * @return The ACPI error level
+ */
+static int __lcd_set_blevel(int level)
+{
+    enum BACKEND backend = this_laptop->backend;
+    acpi_status status;
+    s64 latency;
+
+    int out_of_left_border = (level < laptop_options.min_blevel);
+    int out_of_right_border = (level > laptop_options.max_blevel);
+
+    if (out_of_left_border || out_of_right_border)
+        return -EINVAL;
+
+    /* the cache hits miss until the hardware has the level */
+    lcd_publish_begin();
+    this_laptop->current_blevel = level;
+    this_laptop->cache_valid = 0;
+    lcd_publish_end();
+
+    status = backend_set_blevel(backend, level, &latency);
+    if (unlikely(this_laptop->watchdog.verify) && !ACPI_FAILURE(status))
+        status = watchdog_verify(level);
+
+    lcd_publish_begin();
+    this_laptop->cache_valid = !ACPI_FAILURE(status);
+    if (!ACPI_FAILURE(status))
+        this_laptop->generation++;
+    lcd_publish_end();
+
+    stats_write(latency, ACPI_FAILURE(status));
+    watchdog_account(backend, latency);
+
+    if (!ACPI_FAILURE(status))
+        residency_enter(&level_residency, level);
+
+    return ACPI_FAILURE(status);
+}
+
+/** 
+ * @brief Gets a brightness level, the caller holds the lock
+ * 
+ * @param level The brightness level
+ * 
+ * @return The ACPI error level
+ */
+static int __lcd_get_blevel(int *level)
+{
+    struct ec_batch_t batch = {
+        .count = 1,
+        .regs = { BRTS_REGISTER_ADDRESS },
+    };
+    int data;
+    int left_border = laptop_options.min_blevel;
+    int right_border = laptop_options.max_blevel;
+    int status;
+
+    if (level == NULL)
+        return AE_ERROR;
+
+    (*level) = this_laptop->current_blevel;
+
+    /* the level which is set when the display is on again */
+    if (unlikely(this_laptop->display_off) && this_laptop->pending_blevel >= 0)
+    {
+        (*level) = this_laptop->pending_blevel;
+        return AE_OK;
+    }
+
+    if (cache_level && this_laptop->cache_events && this_laptop->cache_valid)
+    {
+        stats_count(STATS_CACHE_HITS);
+        return AE_OK;
+    }
+
+    stats_count(STATS_READS);
+
+    status = __ec_read_batch(&batch);
+    if (status != AE_OK)
+        return status;
+    data = batch.values[0];
+
+    if (left_border > data || data > right_border)
+    {
+        printk(KERN_ERR AMILO_PA2548_PREFIX
+               "Something is strange the read data is %d but expected data in range from %d to %d\n",
+               data, laptop_options.min_blevel, laptop_options.max_blevel);
+        return AE_ERROR;
+    }
+
+    lcd_publish_begin();
+
+    /* the firmware changed the level */
+    if (data != this_laptop->current_blevel)
+        this_laptop->generation++;
+
+    (*level) = this_laptop->current_blevel = data;
+    this_laptop->cache_valid = 1;
+
+    lcd_publish_end();
+
+    /* the firmware changes the level on its own too */
+    residency_enter(&level_residency, data);
+
+    return AE_OK;
+}
+
+/** 
+ * @brief Sets a brightness level or postpones it until the display is on
+ * again, the caller holds the lock
+ * 
+ * @param level The brightness level in the range 0..7
+ * 
+ * @return The ACPI error level
+ */
+static int __lcd_update_blevel(int level)
+{
+    if (likely(!this_laptop->display_off))
+    {
+        this_laptop->pending_blevel = -1;
+        return __lcd_set_blevel(level);
+    }
+
+    if (level < laptop_options.min_blevel ||
+        level > laptop_options.max_blevel)
+        return -EINVAL;
+
+    /* nobody sees it, only the last level is set later */
+    this_laptop->pending_blevel = level;
+    lcd_publish_begin();
+    this_laptop->generation++;
+    lcd_publish_end();
+    stats_count(STATS_PARKED);
+
+    return 0;
+}
+
+/** 
+ * @brief Refills the cache after the invalidation out of the readers' path
+ * 
+ * @param work The work
+ */
+static void lcd_prefetch(struct work_struct *work)
+{
+    int level;
+
+    mutex_lock(&this_laptop->lock);
+    if (this_laptop->prefetching)
+    {
+        __lcd_get_blevel(&level);
+        this_laptop->prefetching = 0;
+        complete_all(&this_laptop->prefetched);
+    }
+    mutex_unlock(&this_laptop->lock);
+}
+
+/** 
+ * @brief Waits for the refill of the cache if it is in flight, so the
+ * reader does not read the hardware once more
+ *
+ * Only the readers from userspace wait. The refill runs on the driver
+ * workqueue behind the other works, so a work waiting here could stall for
+ * the whole PREFETCH_WAIT_MS; the works call __lcd_get_blevel() under the
+ * lock instead.
+ */
+static void lcd_prefetch_wait(void)
+{
+    if (ACCESS_ONCE(this_laptop->prefetching))
+        wait_for_completion_timeout(&this_laptop->prefetched,
+                                    msecs_to_jiffies(PREFETCH_WAIT_MS));
+}
+
+/** 
+ * @brief Gets the cached brightness level with its generation without the
+ * lock
+ *
+ * The display which is off misses, its level may be parked (see
+ * __lcd_get_blevel()).
+ * 
+ * @param level The brightness level
+ * @param generation The generation of the level or NULL
+ * 
+ * @return Whether the cache was hit
+ */
+static int lcd_get_blevel_cached(int *level, unsigned int *generation)
+{
+    unsigned int seq;
+    int hit;
+
+    if (!cache_level)
+        return 0;
+
+    do
+    {
+        seq = read_seqcount_begin(&this_laptop->seq);
+        hit = this_laptop->cache_events && this_laptop->cache_valid &&
+              !this_laptop->display_off;
+        (*level) = this_laptop->current_blevel;
+        if (generation)
+            (*generation) = this_laptop->generation;
+    }
+    while (read_seqcount_retry(&this_laptop->seq, seq));
+
+    if (hit)
+        stats_count(STATS_CACHE_HITS);
+
+    return hit;
+}
+
+/** 
+ * @brief Gets a brightness level, it must not be called from the works of
+ * the driver (see lcd_prefetch_wait())
+ * 
+ * @param level The brightness level
+ * 
+ * @return The ACPI error level
+ */
+static int lcd_get_blevel(int *level)
+{
+    int status;
+
+    if (level && lcd_get_blevel_cached(level, NULL))
+        return AE_OK;
+
+    lcd_prefetch_wait();
+
+    mutex_lock(&this_laptop->lock);
+    status = __lcd_get_blevel(level);
+    mutex_unlock(&this_laptop->lock);
+
+    return status;
+}
+
+/** 
+ * @brief Wakes up the userspace pollers of the brightness level
+ */
+static void lcd_level_notify(void)
+{
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
+    if (this_laptop->pf_device)
+    {
+        sysfs_notify(&this_laptop->pf_device->dev.kobj, NULL, "lcd_level");
+        sysfs_notify(&this_laptop->pf_device->dev.kobj, NULL, "lcd_state");
+    }
+#endif
+}
+
+/** 
+ * @brief Sets a brightness level requested from userspace, the caller
+ * holds the lock
+ *
+ * The level is passed through the brightness policy.
+ * 
+ * @param source The source of the request (AMILO_PA2548_SOURCE_*)
+ * @param level The requested brightness level
+ * 
+ * @return The ACPI error level
+ */
+static int __lcd_request_blevel(int source, int level)
+{
+    struct amilo_pa2548_policy *policy = this_laptop->policy;
+
+    return __lcd_update_blevel(policy->clamp(policy->on_request(source,
+                                                                level)));
+}
+
+/** 
+ * @brief Sets a brightness level requested from userspace
+ *
+ * The level is passed through the brightness policy.
+ * 
+ * @param source The source of the request (AMILO_PA2548_SOURCE_*)
+ * @param level The requested brightness level
+ * 
+ * @return The ACPI error level
+ */
+static int __maybe_unused lcd_request_blevel(int source, int level)
+{
+    int status;
+
+    mutex_lock(&this_laptop->lock);
+    status = __lcd_request_blevel(source, level);
+    mutex_unlock(&this_laptop->lock);
+
+    if (status == 0)
+        lcd_level_notify();
+
+    return status;
+}
+
+#ifdef HOTKEYS_SUPPORT
+
+/** 
+ * @brief Changes a brightness level by the step in one locked sequence
+ *
+ * The new level is chosen by the brightness policy.
+ * 
+ * @param step The change of the brightness level
+ * 
+ * @return The ACPI error level
+ */
+static int lcd_step_blevel(int step)
+{
+    struct amilo_pa2548_policy *policy;
+    int level;
+    int status;
+
+    mutex_lock(&this_laptop->lock);
+    policy = this_laptop->policy;
+    __lcd_get_blevel(&level);
+    level = policy->clamp(policy->on_hotkey(step, level));
+    status = __lcd_update_blevel(level);
+    mutex_unlock(&this_laptop->lock);
+
+    if (status == 0)
+        lcd_level_notify();
+
+    return status;
+}
+
+#endif
+
+/**
+ * @defgroup eventsgroup The events which change the brightness level
+ * @{
+ */
+
+/** 
+ * @brief Makes the next read revalidate the cached level
+ */
+static void lcd_cache_invalidate(void)
+{
+    int prefetch;
+
+    mutex_lock(&this_laptop->lock);
+    lcd_publish_begin();
+    this_laptop->cache_valid = 0;
+    lcd_publish_end();
+
+    /* refill it before the next reader comes */
+    prefetch = cache_level && this_laptop->cache_events;
+    if (prefetch && !this_laptop->prefetching)
+    {
+        INIT_COMPLETION(this_laptop->prefetched);
+        this_laptop->prefetching = 1;
+    }
+    mutex_unlock(&this_laptop->lock);
+
+    if (prefetch)
+        driver_queue_work(&this_laptop->prefetch_work);
+
+    stats_count(STATS_INVALIDATIONS);
+}
+
+/** 
+ * @brief Invalidates the cache after the resume, the firmware sets the
+ * brightness level on its own
+ *
+ * @param device The platform device
+ *
+ * @return Always zero
+ */
+static int pf_resume(struct platform_device *device)
+{
+    lcd_cache_invalidate();
+
+    return 0;
+}
+
+#ifdef PROFILES_SUPPORT
+
+/** 
+ * @brief Applies the brightness profile of the current power source
+ *
+ * In the target mode the level of the profile is requested, in the ceiling
+ * mode the current level is requested again, so the policy lowers it. The
+ * write is skipped when the level is already set; it is counted as elided
+ * only when the configured level of the profile is the current one.
+ *
+ * @param work The work
+ */
+static void profile_apply(struct work_struct *work)
+{
+    struct amilo_pa2548_policy *policy;
+    int on_ac = power_supply_is_system_supplied() != 0;
+    int level, profile, current_level;
+    int status = -1;
+
+    mutex_lock(&this_laptop->lock);
+
+    this_laptop->on_ac = on_ac;
+    profile = this_laptop->profile_level[on_ac ? PROFILE_AC : PROFILE_BATTERY];
+
+    if (__lcd_get_blevel(&current_level) != AE_OK)
+        current_level = this_laptop->current_blevel;
+
+    level = profile;
+    if (this_laptop->profile_mode != PROFILE_MODE_TARGET || level < 0)
+        level = current_level;
+
+    policy = this_laptop->policy;
+    level = policy->clamp(policy->on_request(AMILO_PA2548_SOURCE_PROFILE,
+                                             level));
+
+    if (level != current_level)
+        status = __lcd_update_blevel(level);
+    else if (profile >= 0 && profile == current_level)
+        stats_count(STATS_ELIDED);
+
+    mutex_unlock(&this_laptop->lock);
+
+    if (status == 0)
+        lcd_level_notify();
+}
+
+/** 
+ * @brief Returns the ceiling of the current power source profile, the
+ * caller holds the lock
+ *
+ * @return The ceiling or -1
+ */
+static int profile_ceiling(void)
+{
+    if (this_laptop->profile_mode != PROFILE_MODE_CEILING ||
+        this_laptop->on_ac < 0)
+        return -1;
+
+    return this_laptop->profile_level[this_laptop->on_ac ? PROFILE_AC :
+                                                           PROFILE_BATTERY];
+}
+
+#else
+
+static inline int profile_ceiling(void) { return -1; }
+
+#endif
+
+/** 
+ * @brief Handles the AC adapter and video events: the firmware changes the
+ * brightness level on them, and the AC adapter switches the profile
+ *
+ * @param nb The notifier block
+ * @param val Unused
+ * @param data The ACPI bus event
+ *
+ * @return Always NOTIFY_DONE
+ */
+static int events_acpi_notify(struct notifier_block *nb, unsigned long val,
+                              void *data)
+{
+    struct acpi_bus_event *event = data;
+
+    if (strcmp(event->device_class, ACPI_AC_ADAPTER_CLASS) == 0)
+    {
+        lcd_cache_invalidate();
+#ifdef PROFILES_SUPPORT
+        driver_queue_work(&this_laptop->profile_work);
+#endif
+    }
+    else if (strcmp(event->device_class, ACPI_VIDEO_DEVICE_CLASS) == 0)
+        lcd_cache_invalidate();
+
+    return NOTIFY_DONE;
+}
+
+/** 
+ * @brief The ACPI events notifier
+ */
+static struct notifier_block events_acpi_nb = {
+    .notifier_call = events_acpi_notify,
+};
+
+#ifdef LID_EVENTS_SUPPORT
+
+/** 
+ * @brief Tracks the lid state, the postponed level is set when the display
+ * is on again
+ *
+ * @param open Whether the lid is open
+ */
+static void lcd_display_lid(int open)
+{
+    int status = -1;
+
+    mutex_lock(&this_laptop->lock);
+
+    lcd_publish_begin();
+    if (open)
+        this_laptop->display_off &= ~DISPLAY_OFF_LID;
+    else
+        this_laptop->display_off |= DISPLAY_OFF_LID;
+    lcd_publish_end();
+
+    if (!this_laptop->display_off && this_laptop->pending_blevel >= 0)
+        status = __lcd_update_blevel(this_laptop->pending_blevel);
+
+    mutex_unlock(&this_laptop->lock);
+
+    if (status == 0)
+        lcd_level_notify();
+}
+
+/** 
+ * @brief Invalidates the cache and tracks the display after the lid is
+ * opened or closed
+ *
+ * @param nb The notifier block
+ * @param val The lid state
+ * @param data Unused
+ *
+ * @return Always NOTIFY_DONE
+ */
+static int events_lid_notify(struct notifier_block *nb, unsigned long val,
+                             void *data)
+{
+    lcd_cache_invalidate();
+    lcd_display_lid(val != 0);
+
+    return NOTIFY_DONE;
+}
+
+/** 
+ * @brief The lid events notifier
+ */
+static struct notifier_block events_lid_nb = {
+    .notifier_call = events_lid_notify,
+};
+
+#endif
+
+/** 
+ * @brief Subscribes to the events which change the brightness level
+ *
+ * The cache is used only if all of them are delivered, so failures are not
+ * fatal.
+ */
+static void events_init(void)
+{
+    this_laptop->cache_events = 0;
+    this_laptop->acpi_events = 0;
+
+    if (register_acpi_notifier(&events_acpi_nb) < 0)
+    {
+        printk(KERN_WARNING AMILO_PA2548_PREFIX
+               "Cannot register the ACPI notifier, the cache is disabled\n");
+        return;
+    }
+    this_laptop->acpi_events = 1;
+
+#ifdef PROFILES_SUPPORT
+    /* the power source at the loading */
+    driver_queue_work(&this_laptop->profile_work);
+#endif
+
+#ifdef LID_EVENTS_SUPPORT
+    if (acpi_lid_notifier_register(&events_lid_nb) < 0)
+    {
+        printk(KERN_WARNING AMILO_PA2548_PREFIX
+               "Cannot register the lid notifier, the cache is disabled\n");
+        return;
+    }
+
+    this_laptop->cache_events = 1;
+
+    /* the lid state at the loading */
+    if (acpi_lid_open() == 0)
+        lcd_display_lid(0);
+#endif
+}
+
+/** 
+ * @brief Unsubscribes from the events which change the brightness level
+ */
+static void events_exit(void)
+{
+#ifdef LID_EVENTS_SUPPORT
+    if (this_laptop->cache_events)
+        acpi_lid_notifier_unregister(&events_lid_nb);
+#endif
+    this_laptop->cache_events = 0;
+
+    if (this_laptop->acpi_events)
+        unregister_acpi_notifier(&events_acpi_nb);
+    this_laptop->acpi_events = 0;
+}
+
+/** @} */
+
+/**
+ * @defgroup policygroup The brightness policy
+ * @{
+ */
+
+/** 
+ * @brief Steps the level by hotkey_step, stops at the borders
+ */
+static int default_policy_on_hotkey(int delta, int cur)
+{
+    int level = cur + delta * ACCESS_ONCE(hotkey_step);
+
+    return clamp_val(level, laptop_options.min_blevel,
+                     laptop_options.max_blevel);
+}
+
+/** 
+ * @brief Sets the requested level as is
+ */
+static int default_policy_on_request(int source, int level)
+{
+    return level;
+}
+
+/** 
+ * @brief Limits the level by max_level and the ceiling of the power source
+ * profile if they are set
+ */
+static int default_policy_clamp(int level)
+{
+    int ceiling = ACCESS_ONCE(max_level);
+    int profile = profile_ceiling();
+
+    if (profile >= 0 && (ceiling < 0 || profile < ceiling))
+        ceiling = profile;
+
+    if (ceiling >= laptop_options.min_blevel && level > ceiling)
+        return ceiling;
+
+    return level;
+}
+
+/** 
+ * @brief Registers the brightness policy instead of the current one
+ *
+ * No reference to the policy module is held: the symbol dependency keeps
+ * this driver loaded while the policy is, and the policy module must call
+ * amilo_pa2548_unregister_policy() from its module_exit.
+ *
+ * @param policy The policy with all the callbacks set
+ *
+ * @return The exit code
+ */
+int amilo_pa2548_register_policy(struct amilo_pa2548_policy *policy)
+{
+    int result = 0;
+
+    if (policy == NULL || !policy->on_hotkey || !policy->on_request ||
+        !policy->clamp)
+        return -EINVAL;
+
+    if (this_laptop == NULL)
+        return -ENODEV;
+
+    mutex_lock(&this_laptop->lock);
+    if (this_laptop->policy != &default_policy)
+        result = -EBUSY;
+    else
+        this_laptop->policy = policy;
+    mutex_unlock(&this_laptop->lock);
+
+    if (result == 0)
+        printk(KERN_INFO AMILO_PA2548_PREFIX "brightness policy '%s' is used\n",
+               policy->name);
+
+    return result;
+}
+EXPORT_SYMBOL_GPL(amilo_pa2548_register_policy);
+
+/** 
+ * @brief Unregisters the brightness policy and restores the default one
+ *
+ * No callback of the policy is running when this function returns.
+ *
+ * @param policy The registered policy
+ */
+void amilo_pa2548_unregister_policy(struct amilo_pa2548_policy *policy)
+{
+    if (this_laptop == NULL)
+        return;
+
+    /* the callbacks run under the lock, so none is running afterwards */
+    mutex_lock(&this_laptop->lock);
+    if (this_laptop->policy == policy && policy != &default_policy)
+        this_laptop->policy = &default_policy;
+    mutex_unlock(&this_laptop->lock);
+}
+EXPORT_SYMBOL_GPL(amilo_pa2548_unregister_policy);
+
+/** 
+ * @brief Returns the last known brightness level without the hardware access
+ *
+ * @return The brightness level
+ */
+int amilo_pa2548_cached_level(void)
+{
+    return this_laptop ? ACCESS_ONCE(this_laptop->current_blevel) : -ENODEV;
+}
+EXPORT_SYMBOL_GPL(amilo_pa2548_cached_level);
+
+/** @} */
+
+#ifdef CONFIG_AMILO_PA2548_BACKLIGHT
+
+/**
+ * @defgroup backlightgroup The backlight related stuff
+ * @{
+ */
+
+/** 
+ * @brief Gets the brightness level
+ *
+ * @param bd The system backlight device
+ *
+ * @return The current brightness level
+ */
+static int bl_get_blevel(struct backlight_device *bd)
+{
+    int level;
+    lcd_get_blevel(&level);
+        
+    return level;
+}
+
+/** 
+ * @brief Blanks or unblanks the backlight
+ *
+ * The hardware cannot turn the backlight off, level 0 is still lit, so
+ * blanking dims it to the lowest level through the selected backend. The
+ * requested level is postponed until the backlight is unblanked.
+ *
+ * @param blank Whether the backlight is blanked
+ * @param level The requested brightness level
+ *
+ * @return The ACPI error level
+ */
+static int bl_set_power(int blank, int level)
+{
+    struct amilo_pa2548_policy *policy;
+    int status = 0;
+
+    mutex_lock(&this_laptop->lock);
+
+    /* the display is on yet, so it is one write with the bookkeeping */
+    if (blank && !(this_laptop->display_off & DISPLAY_OFF_BLANK))
+        status = __lcd_update_blevel(laptop_options.min_blevel);
+
+    if (status == 0)
+    {
+        lcd_publish_begin();
+        if (blank)
+            this_laptop->display_off |= DISPLAY_OFF_BLANK;
+        else
+            this_laptop->display_off &= ~DISPLAY_OFF_BLANK;
+        lcd_publish_end();
+
+        policy = this_laptop->policy;
+        level = policy->clamp(policy->on_request(AMILO_PA2548_SOURCE_BACKLIGHT,
+                                                 level));
+        status = __lcd_update_blevel(level);
+    }
+
+    mutex_unlock(&this_laptop->lock);
+
+    if (status == 0)
+        lcd_level_notify();
+
+    return status;
+}
+
+/** 
+ * @brief Sets the brightness level
+ *
+ * @param bd The system backlight device
+ *
+ * @return The ACPI error level
+ */
+static int bl_set_blevel(struct backlight_device *bd)
+{
+    int blank = bd->props.power != FB_BLANK_UNBLANK ||
+                bd->props.fb_blank != FB_BLANK_UNBLANK;
+
+    trace_record(AMILO_PA2548_TRACE_BL_SET_BLEVEL, bd->props.brightness);
+
+    if (unlikely(blank ||
+                 (ACCESS_ONCE(this_laptop->display_off) & DISPLAY_OFF_BLANK)))
+        return bl_set_power(blank, bd->props.brightness);
+
+    return lcd_request_blevel(AMILO_PA2548_SOURCE_BACKLIGHT,
+                              bd->props.brightness);
+}
+
+/** @} */
+
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
+
+/**
+ * @defgroup platformgroup The platform related stuff
+ * @{
+ */
+
+/** 
+ * @brief Refills the bucket of the writer, the caller holds the lock
+ *
+ * @param w The writer
+ * @param now The current jiffies
+ * @param full The size of the bucket
+ */
+static void throttle_refill(struct throttle_writer_t *w, unsigned long now,
+                            long full)
+{
+    u64 refill = (u64)(now - w->stamp) * ACCESS_ONCE(write_rate);
+
+    w->tokens = min_t(u64, (u64)w->tokens + refill, full);
+    w->stamp = now;
+}
+
+/** 
+ * @brief Finds the writer or gives it a slot, the caller holds the lock
+ *
+ * @param t The throttle
+ * @param uid The writer
+ * @param now The current jiffies
+ * @param full The size of the bucket
+ *
+ * @return The writer
+ */
+static struct throttle_writer_t *throttle_writer(struct throttle_t *t,
+                                                 uid_t uid, unsigned long now,
+                                                 long full)
+{
+    struct throttle_writer_t *w, *victim = &t->writers[0];
+
+    for (w = t->writers; w < t->writers + THROTTLE_WRITERS; ++w)
+    {
+        if (w->used && w->uid == uid)
+        {
+            throttle_refill(w, now, full);
+            return w;
+        }
+
+        if (victim->used && (!w->used || time_before(w->stamp, victim->stamp)))
+            victim = w;
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    victim->used = 1;
+    victim->uid = uid;
+    victim->tokens = full;
+    victim->stamp = now;
+
+    return victim;
+}
+
+/** 
+ * @brief Decides whether the write of the current user is executed now,
+ * otherwise its level is folded and set later
+ *
+ * @param level The written brightness level, already checked to be in range
+ * @param fold Whether the level may be set later, the conditional writes
+ * are refused instead
+ *
+ * @return Whether the write is executed now
+ */
+static int throttle_admit(int level, int fold)
+{
+    struct throttle_t *t = &this_laptop->throttle;
+    unsigned int rate = ACCESS_ONCE(write_rate);
+    long full = (long)max(ACCESS_ONCE(write_burst), 1u) * HZ;
+    struct throttle_writer_t *w;
+    unsigned long delay;
+
+    if (rate == 0)
+    {
+        /* the rate was turned off, this write supersedes the folded one */
+        if (unlikely(ACCESS_ONCE(t->folded_blevel) >= 0))
+        {
+            spin_lock(&t->lock);
+            t->folded_blevel = -1;
+            spin_unlock(&t->lock);
+            cancel_delayed_work(&t->work);
+        }
+        return 1;
+    }
+
+    spin_lock(&t->lock);
+
+    w = throttle_writer(t, current_fsuid(), jiffies, full);
+    if (w->tokens >= HZ)
+    {
+        w->tokens -= HZ;
+        w->admitted++;
+        /* the folded level is older than this one */
+        t->folded_blevel = -1;
+        spin_unlock(&t->lock);
+        return 1;
+    }
+
+    w->throttled++;
+    if (!fold)
+    {
+        spin_unlock(&t->lock);
+        stats_count(STATS_THROTTLED);
+        return 0;
+    }
+
+    t->folded_blevel = level;
+    t->folded_uid = w->uid;
+    delay = DIV_ROUND_UP(HZ - w->tokens, rate);
+
+    spin_unlock(&t->lock);
+
+    stats_count(STATS_THROTTLED);
+    driver_queue_delayed_work(&t->work, delay);
+
+    return 0;
+}
+
+/** 
+ * @brief Sets the latest folded level on behalf of its writer
+ *
+ * @param work The work
+ */
+static void throttle_apply(struct work_struct *work)
+{
+    struct throttle_t *t = &this_laptop->throttle;
+    long full = (long)max(ACCESS_ONCE(write_burst), 1u) * HZ;
+    struct throttle_writer_t *w;
+    int level;
+
+    spin_lock(&t->lock);
+
+    level = t->folded_blevel;
+    t->folded_blevel = -1;
+
+    if (level >= 0)
+    {
+        w = throttle_writer(t, t->folded_uid, jiffies, full);
+        w->tokens = max(w->tokens - HZ, 0L);
+        w->admitted++;
+    }
+
+    spin_unlock(&t->lock);
+
+    if (level >= 0)
+        lcd_request_blevel(AMILO_PA2548_SOURCE_PLATFORM, level);
+}
+
+/** 
+ * @brief Shows the writers of lcd_level: the uid, the executed and the
+ * throttled writes
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ *
+ * @return The number of passed characters
+ */
+static ssize_t pf_show_throttle(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+    struct throttle_t *t = &this_laptop->throttle;
+    struct throttle_writer_t writers[THROTTLE_WRITERS];
+    ssize_t len = 0;
+    int i;
+
+    spin_lock(&t->lock);
+    memcpy(writers, t->writers, sizeof(writers));
+    spin_unlock(&t->lock);
+
+    for (i = 0; i < THROTTLE_WRITERS; ++i)
+        if (writers[i].used)
+            len += scnprintf(buf + len, PAGE_SIZE - len, "%u %lu %lu\n",
+                             (unsigned int)writers[i].uid,
+                             writers[i].admitted, writers[i].throttled);
+
+    return len;
+}
+
+/** 
+ * @brief Gets the platform brightness level
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ *
+ * @return The number of passed characters
+ */
+static ssize_t pf_show_lcd_level(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+    int level;
+    lcd_get_blevel(&level);
+    
+    return sprintf(buf, "%i\n", level);
+}
+
+/** 
+ * @brief Sets the platform brightness level
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ * @param count The count of character in the system buffer
+ *
+ * @return The buffer size
+ */
+static ssize_t pf_store_lcd_level(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    int status;
+    int level;
+
+    status = sscanf(buf, "%i", &level);
+    if (status < 0)
+        level = this_laptop->current_blevel;
+
+    trace_record(AMILO_PA2548_TRACE_PF_STORE_LCD_LEVEL, level);
+
+    /* a folded write succeeds now, so it cannot fail later */
+    if (level < laptop_options.min_blevel || level > laptop_options.max_blevel)
+        return -EINVAL;
+
+    if (!throttle_admit(level, 1))
+        return count;
+
+    status = lcd_request_blevel(AMILO_PA2548_SOURCE_PLATFORM, level);
+    if (status < 0)
+        return status;
+
+    return count;
+}
+
+/** 
+ * @brief Gets the platform brightness level with its generation
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ *
+ * @return The number of passed characters
+ */
+static ssize_t pf_show_lcd_state(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+    unsigned int generation;
+    int level;
+
+    if (lcd_get_blevel_cached(&level, &generation))
+        return sprintf(buf, "%i@%u\n", level, generation);
+
+    lcd_prefetch_wait();
+
+    mutex_lock(&this_laptop->lock);
+    __lcd_get_blevel(&level);
+    generation = this_laptop->generation;
+    mutex_unlock(&this_laptop->lock);
+
+    return sprintf(buf, "%i@%u\n", level, generation);
+}
+
+/** 
+ * @brief Sets the platform brightness level, "level@generation" sets it
+ * only if the generation is not changed since it was read
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ * @param count The count of character in the system buffer
+ *
+ * @return The buffer size or -EAGAIN if the generation differs
+ */
+static ssize_t pf_store_lcd_state(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    unsigned int generation;
+    int status;
+    int level;
+
+    status = sscanf(buf, "%i@%u", &level, &generation);
+    if (status < 1)
+        return -EINVAL;
+
+    /* "5@" or "5@abc" must not become an unconditional write */
+    if (strchr(buf, '@') && status != 2)
+        return -EINVAL;
+
+    if (status < 2)
+    {
+        /* an unconditional write is a write of lcd_level */
+        trace_record(AMILO_PA2548_TRACE_PF_STORE_LCD_LEVEL, level);
+
+        if (level < laptop_options.min_blevel ||
+            level > laptop_options.max_blevel)
+            return -EINVAL;
+
+        if (!throttle_admit(level, 1))
+            return count;
+
+        status = lcd_request_blevel(AMILO_PA2548_SOURCE_PLATFORM, level);
+        if (status < 0)
+            return status;
+
+        return count;
+    }
+
+    trace_record_arg(AMILO_PA2548_TRACE_PF_STORE_LCD_STATE,
+                     clamp_val(level, SHRT_MIN, SHRT_MAX), generation);
+
+    if (level < laptop_options.min_blevel || level > laptop_options.max_blevel)
+        return -EINVAL;
+
+    mutex_lock(&this_laptop->lock);
+
+    /* 
+     * a write which loses the race must not spend a token or drop the
+     * folded level, so it is admitted only after the generation matched
+     */
+    if (generation != this_laptop->generation)
+        status = -EAGAIN;
+    else if (!throttle_admit(level, 0))
+        status = -EBUSY;
+    else
+        status = __lcd_request_blevel(AMILO_PA2548_SOURCE_PLATFORM, level);
+
+    mutex_unlock(&this_laptop->lock);
+
+    if (status < 0)
+        return status;
+
+    if (status == 0)
+        lcd_level_notify();
+
+    return count;
+}
+
+#ifdef PROFILES_SUPPORT
+
+/** 
+ * @brief Returns the profile of the attribute
+ *
+ * @param attr The device attribute
+ *
+ * @return The profile (PROFILE_*)
+ */
+static enum PROFILE pf_profile(struct device_attribute *attr)
+{
+    return (attr == &dev_attr_ac_level) ? PROFILE_AC : PROFILE_BATTERY;
+}
+
+/** 
+ * @brief Gets the brightness level of the power source profile
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ *
+ * @return The number of passed characters
+ */
+static ssize_t pf_show_profile_level(struct device *dev,
+                                     struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%i\n",
+                   ACCESS_ONCE(this_laptop->profile_level[pf_profile(attr)]));
+}
+
+/** 
+ * @brief Sets the brightness level of the power source profile, -1 removes
+ * the profile
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ * @param count The count of character in the system buffer
+ *
+ * @return The buffer size
+ */
+static ssize_t pf_store_profile_level(struct device *dev,
+                                      struct device_attribute *attr,
+                                      const char *buf, size_t count)
+{
+    int level;
+
+    if (sscanf(buf, "%i", &level) != 1)
+        return -EINVAL;
+
+    if (level != -1 && (level < laptop_options.min_blevel ||
+                        level > laptop_options.max_blevel))
+        return -EINVAL;
+
+    mutex_lock(&this_laptop->lock);
+    this_laptop->profile_level[pf_profile(attr)] = level;
+    mutex_unlock(&this_laptop->lock);
+
+    driver_queue_work(&this_laptop->profile_work);
+
+    return count;
+}
+
+/** 
+ * @brief Gets the way to apply the profiles
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ *
+ * @return The number of passed characters
+ */
+static ssize_t pf_show_profile_mode(struct device *dev,
+                                    struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%s\n",
+                   profile_mode_names[ACCESS_ONCE(this_laptop->profile_mode)]);
+}
+
+/** 
+ * @brief Sets the way to apply the profiles: "target" or "ceiling"
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ * @param count The count of character in the system buffer
+ *
+ * @return The buffer size
+ */
+static ssize_t pf_store_profile_mode(struct device *dev,
+                                     struct device_attribute *attr,
+                                     const char *buf, size_t count)
+{
+    enum PROFILE_MODE mode;
+
+    for (mode = 0; mode < PROFILE_MODE_END; mode++)
+        if (sysfs_streq(buf, profile_mode_names[mode]))
+            break;
+
+    if (mode == PROFILE_MODE_END)
+        return -EINVAL;
+
+    mutex_lock(&this_laptop->lock);
+    this_laptop->profile_mode = mode;
+    mutex_unlock(&this_laptop->lock);
+
+    driver_queue_work(&this_laptop->profile_work);
+
+    return count;
+}
+
+#endif
+
+/** @} */
+
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_STATS
+
+/**
+ * @defgroup statsgroup The driver statistics
+ * @{
+ */
+
+/** 
+ * @brief Shows the statistics and the state of the driver
+ *
+ * Every line is "<type> <name> [<bound>] <value>", so the whole snapshot is
+ * taken by one read:
+ * - counter - the monotonic counter;
+ * - histogram - the bucket of the histogram, the bound is in microseconds;
+ * - sum - the sum of the histogram in microseconds;
+ * - gauge - the current value;
+ * - info - the current name.
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ *
+ * @return The number of passed characters
+ */
+static ssize_t pf_show_stats(struct device *dev,
+                             struct device_attribute *attr, char *buf)
+{
+    struct stats_t snapshot;
+    ssize_t len = 0;
+    int cpu, i;
+
+    memset(&snapshot, 0, sizeof(snapshot));
+    for_each_possible_cpu(cpu)
+    {
+        struct stats_t *cpu_stats = &per_cpu(stats, cpu);
+
+        for (i = 0; i < STATS_END; ++i)
+            snapshot.counters[i] += cpu_stats->counters[i];
+        for (i = 0; i < STATS_LATENCY_BUCKETS; ++i)
+            snapshot.latency_buckets[i] += cpu_stats->latency_buckets[i];
+        snapshot.latency_sum_ns += cpu_stats->latency_sum_ns;
+    }
+
+    for (i = 0; i < STATS_END; ++i)
+        len += scnprintf(buf + len, PAGE_SIZE - len, "counter %s %llu\n",
+                         stats_counter_names[i],
+                         (unsigned long long)snapshot.counters[i]);
+
+    for (i = 0; i < STATS_LATENCY_BUCKETS - 1; ++i)
+        len += scnprintf(buf + len, PAGE_SIZE - len,
+                         "histogram write_latency %u %llu\n", 1U << i,
+                         (unsigned long long)snapshot.latency_buckets[i]);
+    len += scnprintf(buf + len, PAGE_SIZE - len,
+                     "histogram write_latency +Inf %llu\n",
+                     (unsigned long long)snapshot.latency_buckets[i]);
+
+    do_div(snapshot.latency_sum_ns, 1000);
+    len += scnprintf(buf + len, PAGE_SIZE - len, "sum write_latency %llu\n",
+                     (unsigned long long)snapshot.latency_sum_ns);
+
+    len += scnprintf(buf + len, PAGE_SIZE - len, "gauge level %d\n",
+                     this_laptop->current_blevel);
+    len += scnprintf(buf + len, PAGE_SIZE - len, "gauge display_off %d\n",
+                     this_laptop->display_off);
+#ifdef CONFIG_AMILO_PA2548_LED
+    /* the last requested brightness, a scrape does not touch the port */
+    len += scnprintf(buf + len, PAGE_SIZE - len, "gauge led %d\n",
+                     ACCESS_ONCE(this_laptop->led_brightness));
+#endif
+    len += scnprintf(buf + len, PAGE_SIZE - len, "info backend %s\n",
+                     backend_names[this_laptop->backend]);
+    len += scnprintf(buf + len, PAGE_SIZE - len, "info policy %s\n",
+                     this_laptop->policy->name);
+
+    return len;
+}
+
+/** 
+ * @brief Copies the residency adding the time spent in the current state
+ *
+ * @param r The residency
+ * @param snapshot The copy
+ */
+static void residency_snapshot(const struct residency_t *r,
+                               struct residency_t *snapshot)
+{
+    ktime_t now = ktime_get();
+    unsigned long flags;
+
+    spin_lock_irqsave(&residency_lock, flags);
+    *snapshot = *r;
+    spin_unlock_irqrestore(&residency_lock, flags);
+
+    if (snapshot->state >= 0)
+        snapshot->ns[snapshot->state] +=
+            ktime_to_ns(ktime_sub(now, snapshot->since));
+}
+
+/** 
+ * @brief Shows the cumulative time in ns spent at every brightness level
+ * and in every LED mode
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer
+ *
+ * @return The number of passed characters
+ */
+static ssize_t pf_show_residency(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+    struct residency_t snapshot;
+    ssize_t len = 0;
+    int i;
+
+    residency_snapshot(&level_residency, &snapshot);
+    for (i = laptop_options.min_blevel;
+         i <= laptop_options.max_blevel && i < RESIDENCY_STATES; ++i)
+        len += scnprintf(buf + len, PAGE_SIZE - len, "level %d %llu\n", i,
+                         (unsigned long long)snapshot.ns[i]);
+
+#ifdef CONFIG_AMILO_PA2548_LED
+    residency_snapshot(&led_residency, &snapshot);
+    for (i = 0; i < LED_MODE_END; ++i)
+        len += scnprintf(buf + len, PAGE_SIZE - len, "led %s %llu\n",
+                         led_mode_names[i], (unsigned long long)snapshot.ns[i]);
+#endif
+
+    return len;
+}
+
+/** 
+ * @brief Resets the residency, the current states are accounted from now
+ *
+ * @param dev The device
+ * @param attr The device attribute
+ * @param buf The system buffer (ignored)
+ * @param count The count of character in the system buffer
+ *
+ * @return The buffer size
+ */
+static ssize_t pf_store_residency(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    ktime_t now = ktime_get();
+    unsigned long flags;
+
+    spin_lock_irqsave(&residency_lock, flags);
+    memset(level_residency.ns, 0, sizeof(level_residency.ns));
+    level_residency.since = now;
+#ifdef CONFIG_AMILO_PA2548_LED
+    memset(led_residency.ns, 0, sizeof(led_residency.ns));
+    led_residency.since = now;
+#endif
+    spin_unlock_irqrestore(&residency_lock, flags);
+
+    return count;
+}
+
+/** @} */
+
+#endif
+
+#ifdef HOTKEYS_SUPPORT
+
+/**
+ * @defgroup acpidrivergroup The ACPI driver group
+ * @{
+ */
+
+/** 
+ * Adds ACPI driver to kernelspace - registers input device to trap ACPI events
+ * 
+ * @param device The ACPI device
+ * 
+ * @return The exit code
+ */
+static int acpi_driver_add(struct acpi_device *device)
+{
+    struct input_dev *input;
+    int result = 0;
+
+    if (device == NULL)
+    {
+        result = -EINVAL;
+        goto __failed_to_get_device;
+    }
+
+    sprintf(acpi_device_name(device), "%s", AMILO_PA2548_DRIVER_NAME);
+    sprintf(acpi_device_class(device), "%s", AMILO_PA2548_DRIVER_CLASS);
+
+    device->driver_data = this_laptop;
+
+    input = input_allocate_device();
+    if (input == NULL)
+    {
+        result = -ENOMEM;
+        goto __failed_to_allocate_input_device;
+    }
+    this_laptop->input = input;
+
+    snprintf(this_laptop->input_phys, sizeof(this_laptop->input_phys),
+             "%s/video/input0", acpi_device_hid(device));
+
+    input->name = acpi_device_name(device);
+
+    input->phys = this_laptop->input_phys;
+    input->id.bustype = BUS_HOST;
+    input->id.product = 0x06;
+    input->dev.parent = &device->dev;
+    input->evbit[0] = BIT(EV_KEY);
+    set_bit(KEY_BRIGHTNESSUP, input->keybit);
+    set_bit(KEY_BRIGHTNESSDOWN, input->keybit);
+    set_bit(KEY_UNKNOWN, input->keybit);
+
+    result = input_register_device(input);
+    if (result)
+    {
+        printk(KERN_ERR AMILO_PA2548_PREFIX "Cannot register input device\n");
+        goto __failed_to_register_input_device;
+    }
+
+    this_laptop->driver_device = device;
+
+    return 0;
+
+__failed_to_register_input_device:
+    input_free_device(input);
+    this_laptop->input = NULL;
+
+__failed_to_allocate_input_device:
+__failed_to_get_device:
+
+   return result;
+}
+
+/** 
+ * Removes the ACPI driver from kernelspace
+ * 
+ * @param device The ACPI device
+ * @param type The type of the ACPI driver
+ * 
+ * @return The exit code
  */
-static int dmi_setup_opts_to_amilo_pa_2548(const struct dmi_system_id *dsid)
+static int acpi_driver_remove(struct acpi_device *device, int type)
 {
-    this_laptop->options = model_options[MODEL_AMILO_PA_2548];
+    int result = 0;
 
-    return 0;
+    if (device == NULL)
+        result = -EINVAL;
+
+    /* free the input device */
+    safe_do(this_laptop->input, input_free_device(this_laptop->input));
+    this_laptop->input = NULL;
+
+    return result;
 }
 
 /** 
- * @brief Sets a brightness level
- * 
- * @param level The brightness level in the range 0..7
+ * Takes the timestamp of the hotkey handling stage if it is measured
+ */
+#define hotkey_stamp(measure, stamp, stage)                         \
+    do {                                                            \
+        if (measure)                                                \
+            (stamp)[stage] = ktime_get();                           \
+    } while (0)
+
+/** 
+ * Accounts the latencies of the handled hotkey
  * 
- * @return The ACPI error level
+ * @param stamp The timestamps of every handling stage
  */
-static int lcd_set_blevel(int level)
+static void hotkey_latency_account(const ktime_t *stamp)
 {
-    int status = 0;
-    union acpi_object arg0 = { ACPI_TYPE_INTEGER };
-    struct acpi_object_list args = { 1, &arg0 };
+    struct hotkey_latency_t *stats = &hotkey_latency;
+    s64 latency;
+    unsigned long flags;
+    int i;
 
-    int out_of_left_border = (level < this_laptop->options.min_blevel);
-    int out_of_right_border = (level > this_laptop->options.max_blevel);
+    spin_lock_irqsave(&stats->lock, flags);
 
-    if (out_of_left_border || out_of_right_border)
-        return -EINVAL;
-
-    this_laptop->current_blevel = level;
-    arg0.integer.value = level;
-    status =
-        acpi_evaluate_object(NULL, (char *)this_laptop->options.BCM, &args,
-                             NULL);
+    for (i = 0; i < HOTKEY_STAGE_END; ++i)
+    {
+        if (i == HOTKEY_STAGE_NOTIFY)
+            latency = ktime_to_ns(ktime_sub(stamp[HOTKEY_STAGE_END - 1],
+                                            stamp[HOTKEY_STAGE_NOTIFY]));
+        else
+            latency = ktime_to_ns(ktime_sub(stamp[i], stamp[i - 1]));
+
+        if (stats->samples == 0 || latency < stats->min[i])
+            stats->min[i] = latency;
+        if (latency > stats->max[i])
+            stats->max[i] = latency;
+
+        stats->last[i] = latency;
+        stats->sum[i] += latency;
+    }
+    stats->samples++;
 
-    return ACPI_FAILURE(status);
+    spin_unlock_irqrestore(&stats->lock, flags);
 }
 
 /** 
- * @brief Gets a brightness level
- * 
- * @param level The brightness level
+ * Handles notifications
  * 
- * @return The ACPI error level
+ * @param device The ACPI device
+ * @param event The ACPI event
  */
-static int lcd_get_blevel(int *level)
+static void acpi_driver_notify(struct acpi_device *device, u32 event)
 {
-    int data = -1;
-    int left_border = this_laptop->options.min_blevel;
-    int right_border = this_laptop->options.max_blevel;
-    int status;
+    struct input_dev *input = NULL;
+    int keycode = 0;
+    int step = 0;
+    ktime_t stamp[HOTKEY_STAGE_END];
+    int measure = feature_enabled(FEATURE_HOTKEY_LATENCY);
 
-    if (level == NULL)
-        return AE_ERROR;
+    hotkey_stamp(measure, stamp, HOTKEY_STAGE_NOTIFY);
 
-    (*level) = this_laptop->current_blevel;
+    trace_record(AMILO_PA2548_TRACE_ACPI_NOTIFY, event);
+    stats_count(STATS_NOTIFIES);
 
-    status = acpi_os_write_port(IO_PORT_ADDRESS_SET, BRTS_REGISTER_ADDRESS, 1);
-    if (status < 0)
+    input = this_laptop->input;
+
+    switch (event)
     {
-        printk(KERN_ERR AMILO_PA2548_PREFIX
-               "Cannot to write data: %d in port 0x%X\n", BRTS_REGISTER_ADDRESS,
-               IO_PORT_ADDRESS_SET);
-        return AE_ERROR;
+        case ACPI_VIDEO_NOTIFY_DEC_BRIGHTNESS:
+            step = -1;
+            keycode = KEY_BRIGHTNESSDOWN;
+            break;
+
+        case ACPI_VIDEO_NOTIFY_INC_BRIGHTNESS:
+            step = 1;
+            keycode = KEY_BRIGHTNESSUP;
+            break;
+
+        default:
+            keycode = 0;
+            printk(KERN_WARNING AMILO_PA2548_PREFIX "Unknown event: 0x%X\n",
+                   event);
     }
 
-    status = acpi_os_read_port(IO_PORT_DATA_RW, &data, 1);
-    if (status < 0)
+    if (keycode != 0)
     {
-        printk(KERN_ERR AMILO_PA2548_PREFIX
-               "Cannot to read data from port: 0x%X\n", IO_PORT_DATA_RW);
-        return AE_ERROR;
+        lcd_step_blevel(step);
+        hotkey_stamp(measure, stamp, HOTKEY_STAGE_HW_WRITE);
+
+        acpi_bus_generate_proc_event(this_laptop->driver_device, event, 0);
+        hotkey_stamp(measure, stamp, HOTKEY_STAGE_PROC_EVENT);
+
+        input_report_key(input, keycode, 1);
+        input_sync(input);
+        input_report_key(input, keycode, 0);
+        input_sync(input);
+        hotkey_stamp(measure, stamp, HOTKEY_STAGE_INPUT_SYNC);
+
+        if (measure)
+            hotkey_latency_account(stamp);
     }
+}
 
-    if (left_border > data || data > right_border)
+/** @} */
+
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_LED
+
+/**
+ * @defgroup leddrivergroup The LED driver group
+ * @{ 
+ */
+
+/** 
+ * Returns a brightness of the 'silentmode' LED
+ * 
+ * @param device The LED device
+ * 
+ * @return The brightness of the 'silentmode' LED
+ */
+static enum led_brightness led_sm_brightness_get(struct led_classdev *device)
+{
+    enum led_brightness brightness = LED_OFF;
+    int status = 0;
+    u32 led_data = 0;
+
+    /* the hardware does not have the requested brightness yet */
+    if (work_pending(&this_laptop->led_work))
+        return ACCESS_ONCE(this_laptop->led_brightness);
+
+    status = acpi_os_read_port(IO_PORT_LED_ADDRESS, &led_data, 1);
+    if (status < 0)
     {
-        printk(KERN_ERR AMILO_PA2548_PREFIX
-               "Something is strange the read data is %d but expected data in range from %d to %d\n",
-               data, this_laptop->options.min_blevel, this_laptop->options.max_blevel);
-        return AE_ERROR;
+        printk(KERN_ERR AMILO_PA2548_PREFIX "Cannot read led brightness data\n");
+        return LED_OFF;
     }
 
-    (*level) = this_laptop->current_blevel = data;
+    if (led_data & 0x01)
+        brightness = LED_FULL;
+    else if (led_data & 0x02)
+        brightness = LED_HALF;
+    else
+        brightness = LED_OFF;
 
-    return AE_OK;
+    return brightness;
 }
 
-/**
- * @defgroup backlightgroup The backlight related stuff
- * @{
+#ifdef CONFIG_AMILO_PA2548_STATS
+
+/** 
+ * Returns the mode of the 'silentmode' LED
+ * 
+ * @param brightness The LED brightness
+ * 
+ * @return The LED mode (LED_MODE_*)
  */
+static int led_sm_mode(enum led_brightness brightness)
+{
+    if (brightness >= LED_FULL)
+        return LED_MODE_FULL;
+    else if (brightness >= LED_HALF)
+        return LED_MODE_HALF;
+
+    return LED_MODE_OFF;
+}
+
+#endif
 
 /** 
- * @brief Gets the brightness level
- *
- * @param bd The system backlight device
- *
- * @return The current brightness level
+ * Writes the requested brightness of the 'silentmode' LED, it may sleep
+ * 
+ * @param work The work
  */
-static int bl_get_blevel(struct backlight_device *bd)
+static void led_sm_write(struct work_struct *work)
 {
-    int level;
-    lcd_get_blevel(&level);
-        
-    return level;
+    enum led_brightness brightness = ACCESS_ONCE(this_laptop->led_brightness);
+    int status = 0;
+    u32 led_data = 0;
+
+    if (brightness >= LED_FULL)
+        led_data = 0x05;
+    else if (brightness >= LED_HALF)
+        led_data = 0x06;
+    else
+        led_data = 0x04;
+
+    status = acpi_os_write_port(IO_PORT_LED_ADDRESS, led_data, 1);
+    if (status < 0)
+    {
+        stats_count(STATS_ERRORS);
+        if (printk_ratelimit())
+            printk(KERN_ERR AMILO_PA2548_PREFIX "Cannot set led brightness\n");
+    }
+    else
+        residency_enter(&led_residency, led_sm_mode(brightness));
 }
 
 /** 
- * @brief Sets the brightness level
- *
- * @param bd The system backlight device
+ * Sets a brightness of the 'silentmode' LED
  *
- * @return The ACPI error level
+ * The LED triggers call it from the timer and the interrupt context, so
+ * the port access and the logging are deferred to the work and only the
+ * last brightness is written.
+ * 
+ * @param device The LED device
+ * @param brightness The LED brightness
  */
-static int bl_set_blevel(struct backlight_device *bd)
+static void led_sm_brightness_set(struct led_classdev *device,
+                                  enum led_brightness brightness)
 {
-    return lcd_set_blevel(bd->props.brightness);
+    trace_record(AMILO_PA2548_TRACE_LED_SM_SET, brightness);
+
+    ACCESS_ONCE(this_laptop->led_brightness) = brightness;
+    driver_queue_work(&this_laptop->led_work);
 }
 
 /** @} */
 
+#endif
+
+#ifdef DEBUGFS_SUPPORT
+
 /**
- * @defgroup platformgroup The platform related stuff
+ * @defgroup debugfsgroup The debugfs related stuff
  * @{
  */
 
+#ifdef HOTKEYS_SUPPORT
+
 /** 
- * @brief Gets the platform brightness level
- *
- * @param dev The device
- * @param attr The device attribute
- * @param buf The system buffer
- *
- * @return The number of passed characters
+ * Injects a synthetic hotkey event into the notify handler
+ * 
+ * @param file The debugfs file
+ * @param ubuf The user buffer with the event code (0x86 or 0x87)
+ * @param count The size of the user buffer
+ * @param ppos The file position
+ * 
+ * @return The number of consumed characters or the error code
  */
-static ssize_t pf_show_lcd_level(struct device *dev,
-                                 struct device_attribute *attr, char *buf)
+static ssize_t debugfs_hotkey_inject_write(struct file *file,
+                                           const char __user *ubuf,
+                                           size_t count, loff_t *ppos)
 {
-    int level;
-    lcd_get_blevel(&level);
-    
-    return sprintf(buf, "%i\n", level);
+    char buf[16];
+    unsigned long event;
+
+    if (count >= sizeof(buf))
+        return -EINVAL;
+
+    if (copy_from_user(buf, ubuf, count))
+        return -EFAULT;
+    buf[count] = '\0';
+
+    event = simple_strtoul(buf, NULL, 0);
+    if (event != ACPI_VIDEO_NOTIFY_INC_BRIGHTNESS &&
+        event != ACPI_VIDEO_NOTIFY_DEC_BRIGHTNESS)
+        return -EINVAL;
+
+    if (this_laptop->driver_device == NULL || this_laptop->input == NULL)
+        return -ENODEV;
+
+    acpi_driver_notify(this_laptop->driver_device, event);
+
+    return count;
 }
 
 /** 
- * @brief Sets the platform brightness level
- *
- * @param dev The device
- * @param attr The device attribute
- * @param buf The system buffer
- * @param count The count of character in the system buffer
- *
- * @return The buffer size
+ * Shows the latency statistics of the hotkey handling
+ * 
+ * @param m The sequence file
+ * @param v Unused
+ * 
+ * @return Always the normal status
  */
-static ssize_t pf_store_lcd_level(struct device *dev,
-                                  struct device_attribute *attr,
-                                  const char *buf, size_t count)
+static int debugfs_hotkey_latency_show(struct seq_file *m, void *v)
 {
-    int status;
-    int level;
+    static const char *stage_names[HOTKEY_STAGE_END] = {
+        [HOTKEY_STAGE_NOTIFY] = "total",
+        [HOTKEY_STAGE_HW_WRITE] = "hw_write",
+        [HOTKEY_STAGE_PROC_EVENT] = "proc_event",
+        [HOTKEY_STAGE_INPUT_SYNC] = "input_sync",
+    };
+    struct hotkey_latency_t stats;
+    unsigned long flags;
+    int i;
+
+    spin_lock_irqsave(&hotkey_latency.lock, flags);
+    stats = hotkey_latency;
+    spin_unlock_irqrestore(&hotkey_latency.lock, flags);
+
+    seq_printf(m, "samples: %llu\n", (unsigned long long)stats.samples);
+    seq_printf(m, "%-12s %12s %12s %12s %12s\n",
+               "stage", "last_ns", "min_ns", "avg_ns", "max_ns");
+
+    for (i = HOTKEY_STAGE_NOTIFY + 1; i <= HOTKEY_STAGE_END; ++i)
+    {
+        int stage = i % HOTKEY_STAGE_END;    /* the total goes last */
+        u64 avg = 0;
 
-    status = sscanf(buf, "%i", &level);
-    if (status < 0)
-        level = this_laptop->current_blevel;
+        if (stats.samples)
+        {
+            avg = stats.sum[stage];
+            do_div(avg, stats.samples);
+        }
 
-    status = lcd_set_blevel(level);
-    if (status < 0)
-        return status;
+        seq_printf(m, "%-12s %12lld %12lld %12llu %12lld\n",
+                   stage_names[stage], stats.last[stage], stats.min[stage],
+                   (unsigned long long)avg, stats.max[stage]);
+    }
+
+    return 0;
+}
+
+static int debugfs_hotkey_latency_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, debugfs_hotkey_latency_show, NULL);
+}
+
+/** 
+ * Resets the latency statistics of the hotkey handling
+ * 
+ * @param file The debugfs file
+ * @param ubuf The user buffer (ignored)
+ * @param count The size of the user buffer
+ * @param ppos The file position
+ * 
+ * @return The number of consumed characters
+ */
+static ssize_t debugfs_hotkey_latency_write(struct file *file,
+                                            const char __user *ubuf,
+                                            size_t count, loff_t *ppos)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&hotkey_latency.lock, flags);
+    hotkey_latency.samples = 0;
+    memset(hotkey_latency.last, 0, sizeof(hotkey_latency.last));
+    memset(hotkey_latency.min, 0, sizeof(hotkey_latency.min));
+    memset(hotkey_latency.max, 0, sizeof(hotkey_latency.max));
+    memset(hotkey_latency.sum, 0, sizeof(hotkey_latency.sum));
+    spin_unlock_irqrestore(&hotkey_latency.lock, flags);
 
     return count;
 }
 
-/** @} */
+/** 
+ * @brief The hotkey injection file operations
+ */
+static const struct file_operations debugfs_hotkey_inject_fops = {
+    .owner = THIS_MODULE,
+    .write = debugfs_hotkey_inject_write,
+};
+
+/** 
+ * @brief The hotkey latency file operations
+ */
+static const struct file_operations debugfs_hotkey_latency_fops = {
+    .owner = THIS_MODULE,
+    .open = debugfs_hotkey_latency_open,
+    .read = seq_read,
+    .write = debugfs_hotkey_latency_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
 
-#ifndef KERNEL_ALREADY_HAS_IT
+#endif
 
-/**
- * @defgroup acpidrivergroup The ACPI driver group
- * @{
+/** 
+ * @brief The EC registers shown by the ec file, they are changed under the
+ * lock
  */
+static struct ec_batch_t debugfs_ec_batch = {
+    .count = 1,
+    .regs = { BRTS_REGISTER_ADDRESS },
+};
 
 /** 
- * Adds ACPI driver to kernelspace - registers input device to trap ACPI events
+ * Shows the EC registers of the set read in one transaction
  * 
- * @param device The ACPI device
+ * @param m The sequence file
+ * @param v Unused
  * 
  * @return The exit code
  */
-static int acpi_driver_add(struct acpi_device *device)
+static int debugfs_ec_show(struct seq_file *m, void *v)
 {
-    struct input_dev *input;
-    int result = 0;
+    struct ec_batch_t batch;
+    unsigned int i;
+    int status;
 
-    if (device == NULL)
-    {
-        result = -EINVAL;
-        goto __failed_to_get_device;
-    }
+    mutex_lock(&this_laptop->lock);
+    batch = debugfs_ec_batch;
+    mutex_unlock(&this_laptop->lock);
 
-    sprintf(acpi_device_name(device), "%s", AMILO_PA2548_DRIVER_NAME);
-    sprintf(acpi_device_class(device), "%s", AMILO_PA2548_DRIVER_CLASS);
+    status = ec_read_batch(&batch);
+    if (status != AE_OK)
+        return -EIO;
 
-    device->driver_data = this_laptop;
+    seq_printf(m, "stamp_ns %lld\n", (long long)ktime_to_ns(batch.stamp));
+    for (i = 0; i < batch.count; ++i)
+        seq_printf(m, "0x%02x 0x%02x\n", batch.regs[i], batch.values[i]);
 
-    input = input_allocate_device();
-    if (input == NULL)
-    {
-        result = -ENOMEM;
-        goto __failed_to_allocate_input_device;
-    }
-    this_laptop->input = input;
+    return 0;
+}
 
-    snprintf(this_laptop->input_phys, sizeof(this_laptop->input_phys),
-             "%s/video/input0", acpi_device_hid(device));
+static int debugfs_ec_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, debugfs_ec_show, NULL);
+}
 
-    input->name = acpi_device_name(device);
+/** 
+ * Sets the EC registers shown by the ec file
+ * 
+ * @param file The debugfs file
+ * @param ubuf The user buffer with the registers, e.g. "0xf3 0xf4"
+ * @param count The size of the user buffer
+ * @param ppos The file position
+ * 
+ * @return The number of consumed characters or the error code
+ */
+static ssize_t debugfs_ec_write(struct file *file, const char __user *ubuf,
+                                size_t count, loff_t *ppos)
+{
+    struct ec_batch_t batch;
+    char buf[EC_BATCH_MAX * 5 + 1];
+    char *pos = buf, *end;
+    unsigned long reg;
 
-    input->phys = this_laptop->input_phys;
-    input->id.bustype = BUS_HOST;
-    input->id.product = 0x06;
-    input->dev.parent = &device->dev;
-    input->evbit[0] = BIT(EV_KEY);
-    set_bit(KEY_BRIGHTNESSUP, input->keybit);
-    set_bit(KEY_BRIGHTNESSDOWN, input->keybit);
-    set_bit(KEY_UNKNOWN, input->keybit);
+    if (count >= sizeof(buf))
+        return -EINVAL;
 
-    result = input_register_device(input);
-    if (result)
-    {
-        printk(KERN_ERR AMILO_PA2548_PREFIX "Cannot register input device\n");
-        goto __failed_to_register_input_device;
-    }
+    if (copy_from_user(buf, ubuf, count))
+        return -EFAULT;
+    buf[count] = '\0';
 
-    this_laptop->driver_device = device;
+    memset(&batch, 0, sizeof(batch));
+    for (;;)
+    {
+        reg = simple_strtoul(pos, &end, 0);
+        if (end == pos)
+            break;
+        if (reg > 0xff || batch.count == EC_BATCH_MAX)
+            return -EINVAL;
 
-    return 0;
+        batch.regs[batch.count++] = reg;
+        pos = end;
+        while (*pos == ' ' || *pos == ',' || *pos == '\n')
+            pos++;
+    }
 
-__failed_to_register_input_device:
-    input_free_device(input);
-    this_laptop->input = NULL;
+    if (batch.count == 0 || *pos != '\0')
+        return -EINVAL;
 
-__failed_to_allocate_input_device:
-__failed_to_get_device:
+    mutex_lock(&this_laptop->lock);
+    debugfs_ec_batch = batch;
+    mutex_unlock(&this_laptop->lock);
 
-   return result;
+    return count;
 }
 
 /** 
- * Removes the ACPI driver from kernelspace
+ * @brief The EC registers file operations
+ */
+static const struct file_operations debugfs_ec_fops = {
+    .owner = THIS_MODULE,
+    .open = debugfs_ec_open,
+    .read = seq_read,
+    .write = debugfs_ec_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/** 
+ * Reads and removes the recorded calls of the entry points
  * 
- * @param device The ACPI device
- * @param type The type of the ACPI driver
+ * @param file The debugfs file
+ * @param ubuf The user buffer
+ * @param count The size of the user buffer
+ * @param ppos The file position
  * 
- * @return The exit code
+ * @return The number of read bytes (only whole records) or the error code
  */
-static int acpi_driver_remove(struct acpi_device *device, int type)
+static ssize_t debugfs_trace_read(struct file *file, char __user *ubuf,
+                                  size_t count, loff_t *ppos)
 {
-    int result = 0;
+    struct trace_recorder_t *recorder = &trace_recorder;
+    struct amilo_pa2548_trace_record batch[16];
+    size_t wanted = count / sizeof(batch[0]);
+    ssize_t result = 0;
+    unsigned long flags;
+    unsigned int n;
+
+    while (wanted > 0)
+    {
+        spin_lock_irqsave(&recorder->lock, flags);
+        for (n = 0; n < ARRAY_SIZE(batch) && n < wanted && recorder->count; ++n)
+        {
+            batch[n] = recorder->records[recorder->head];
+            recorder->head = (recorder->head + 1) & (recorder->size - 1);
+            recorder->count--;
+        }
+        spin_unlock_irqrestore(&recorder->lock, flags);
 
-    if (device == NULL)
-        result = -EINVAL;
+        if (n == 0)
+            break;
 
-    /* free the input device */
-    safe_do(this_laptop->input, input_free_device(this_laptop->input));
-    this_laptop->input = NULL;
+        if (copy_to_user(ubuf + result, batch, n * sizeof(batch[0])))
+            return result ? result : -EFAULT;
+
+        result += n * sizeof(batch[0]);
+        wanted -= n;
+    }
 
     return result;
 }
 
 /** 
- * Handles notifications
- * 
- * @param device The ACPI device
- * @param event The ACPI event
+ * @brief The trace file operations
  */
-static void acpi_driver_notify(struct acpi_device *device, u32 event)
-{
-    struct input_dev *input = NULL;
-    int keycode = 0;
-    int level;
+static const struct file_operations debugfs_trace_fops = {
+    .owner = THIS_MODULE,
+    .open = nonseekable_open,
+    .read = debugfs_trace_read,
+    .llseek = no_llseek,
+};
 
-    input = this_laptop->input;
+/** 
+ * Preallocates the ring of the trace records
+ *
+ * @return The exit code
+ */
+static int trace_recorder_init(void)
+{
+    struct trace_recorder_t *recorder = &trace_recorder;
+    unsigned int size;
 
-    lcd_get_blevel(&level);
+    size = clamp_val(trace_records, TRACE_RECORDS_MIN, TRACE_RECORDS_MAX);
+    size = roundup_pow_of_two(size);
 
-    switch (event)
+    recorder->records = vmalloc(size * sizeof(recorder->records[0]));
+    if (recorder->records == NULL)
     {
-        case ACPI_VIDEO_NOTIFY_DEC_BRIGHTNESS:
-            lcd_set_blevel(--level);
-            keycode = KEY_BRIGHTNESSDOWN;
-            acpi_bus_generate_proc_event(this_laptop->driver_device,
-                                         ACPI_VIDEO_NOTIFY_DEC_BRIGHTNESS, 0);
-            break;
-
-        case ACPI_VIDEO_NOTIFY_INC_BRIGHTNESS:
-            lcd_set_blevel(++level);
-            keycode = KEY_BRIGHTNESSUP;
-            acpi_bus_generate_proc_event(this_laptop->driver_device,
-                                         ACPI_VIDEO_NOTIFY_INC_BRIGHTNESS, 0);
-            break;
-
-        default:
-            keycode = 0;
-            printk(KERN_WARNING AMILO_PA2548_PREFIX "Unknown event: 0x%X\n",
-                   event);
+        printk(KERN_WARNING AMILO_PA2548_PREFIX
+               "Cannot allocate %u trace records\n", size);
+        return -ENOMEM;
     }
 
-    if (keycode != 0)
-    {
-        input_report_key(input, keycode, 1);
-        input_sync(input);
-        input_report_key(input, keycode, 0);
-        input_sync(input);
-   }
-}
-
-/** @} */
+    recorder->head = 0;
+    recorder->count = 0;
+    recorder->dropped = 0;
+    recorder->size = size;
 
-#endif
+    return 0;
+}
 
-/**
- * @defgroup leddrivergroup The LED driver group
- * @{ 
+/** 
+ * Frees the ring of the trace records
  */
+static void trace_recorder_exit(void)
+{
+    struct trace_recorder_t *recorder = &trace_recorder;
+    struct amilo_pa2548_trace_record *records;
+    unsigned long flags;
+
+    spin_lock_irqsave(&recorder->lock, flags);
+    records = recorder->records;
+    recorder->records = NULL;
+    recorder->count = 0;
+    recorder->size = 0;
+    spin_unlock_irqrestore(&recorder->lock, flags);
+
+    if (records)
+        vfree(records);
+}
 
 /** 
- * Returns a brightness of the 'silentmode' LED
- * 
- * @param device The LED device
- * 
- * @return The brightness of the 'silentmode' LED
+ * Creates the debugfs files of the driver
+ *
+ * The debugfs is optional, so failures are not fatal.
  */
-static enum led_brightness led_sm_brightness_get(struct led_classdev *device)
+static void debugfs_init(void)
 {
-    enum led_brightness brightness = LED_OFF;
-    int status = 0;
-    u32 led_data = 0;
+    struct dentry *dir;
 
-    status = acpi_os_read_port(IO_PORT_LED_ADDRESS, &led_data, 1);
-    if (status < 0)
+    dir = debugfs_create_dir(AMILO_PA2548_SYSTEM_NAME, NULL);
+    if (dir == NULL || IS_ERR(dir))
     {
-        printk(KERN_ERR AMILO_PA2548_PREFIX "Cannot read led brightness data\n");
-        return LED_OFF;
+        this_laptop->debugfs_dir = NULL;
+        return;
     }
+    this_laptop->debugfs_dir = dir;
 
-    if (led_data & 0x01)
-        brightness = LED_FULL;
-    else if (led_data & 0x02)
-        brightness = LED_HALF;
-    else
-        brightness = LED_OFF;
+#ifdef HOTKEYS_SUPPORT
+    debugfs_create_file("hotkey_inject", S_IWUSR, dir, NULL,
+                        &debugfs_hotkey_inject_fops);
+    debugfs_create_file("hotkey_latency", S_IRUSR | S_IWUSR, dir, NULL,
+                        &debugfs_hotkey_latency_fops);
+#endif
 
-    return brightness;
+    debugfs_create_file("ec", S_IRUSR | S_IWUSR, dir, NULL, &debugfs_ec_fops);
+
+    if (trace_recorder_init() == 0)
+    {
+        debugfs_create_file("trace", S_IRUSR, dir, NULL, &debugfs_trace_fops);
+        debugfs_create_u32("trace_dropped", S_IRUSR, dir,
+                           &trace_recorder.dropped);
+    }
 }
 
 /** 
- * Sets a brightness of the 'silentmode' LED
- * 
- * @param device The LED device
- * @param brightness The LED brightness
+ * Removes the debugfs files of the driver
  */
-static void led_sm_brightness_set(struct led_classdev *device,
-                                  enum led_brightness brightness)
+static void debugfs_exit(void)
 {
-    int status = 0;
-    u32 led_data = 0;
-    
-    if (brightness >= LED_FULL)
-        led_data = 0x05;
-    else if (brightness >= LED_HALF)
-        led_data = 0x06;
-    else
-        led_data = 0x04;
+    safe_do(this_laptop->debugfs_dir,
+            debugfs_remove_recursive(this_laptop->debugfs_dir));
+    this_laptop->debugfs_dir = NULL;
 
-    status = acpi_os_write_port(IO_PORT_LED_ADDRESS, led_data, 1);
-    if (status < 0)
-        printk(KERN_ERR AMILO_PA2548_PREFIX "Cannot set led brightness\n");
+    trace_recorder_exit();
 }
 
 /** @} */
 
+#else
+
+static inline void debugfs_init(void) {}
+static inline void debugfs_exit(void) {}
+
+#endif
+
 static void this_laptop_init(struct amilo_pa2548_t *this)
 {
+    mutex_init(&this->lock);
+    seqcount_init(&this->seq);
+    this->policy = &default_policy;
+
+    for (this->backend = 0; this->backend < BACKEND_END; this->backend++)
+        if (strcmp(backend_name, backend_names[this->backend]) == 0)
+            break;
+
+    if (this->backend == BACKEND_END)
+    {
+        printk(KERN_WARNING AMILO_PA2548_PREFIX
+               "unknown backend '%s', using acpi\n", backend_name);
+        this->backend = BACKEND_ACPI;
+    }
+
+    this->watchdog.preferred = this->backend;
+    INIT_DELAYED_WORK(&this->watchdog.probe, watchdog_probe);
+
+    this->display_off = 0;
+    this->pending_blevel = -1;
+
+    this->prefetching = 0;
+    INIT_WORK(&this->prefetch_work, lcd_prefetch);
+    init_completion(&this->prefetched);
+
+#ifdef CONFIG_AMILO_PA2548_LED
+    INIT_WORK(&this->led_work, led_sm_write);
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
+    spin_lock_init(&this->throttle.lock);
+    this->throttle.folded_blevel = -1;
+    INIT_DELAYED_WORK(&this->throttle.work, throttle_apply);
+#endif
+
+#ifdef PROFILES_SUPPORT
+    this->profile_level[PROFILE_AC] = -1;
+    this->profile_level[PROFILE_BATTERY] = -1;
+    this->profile_mode = PROFILE_MODE_TARGET;
+    this->on_ac = -1;
+    INIT_WORK(&this->profile_work, profile_apply);
+#endif
+
     this->pf_device = NULL;
     this->bl_device = NULL;
-#ifndef KERNEL_ALREADY_HAS_IT
+#ifdef HOTKEYS_SUPPORT
     this->input = NULL;
     this->driver_device = NULL;
     
@@ -735,10 +4071,12 @@ static void this_laptop_init(struct amilo_pa2548_t *this)
 
     {
         int level;
-        this->current_blevel = this->options.max_blevel;
+        this->current_blevel = laptop_options.max_blevel;
         if (lcd_get_blevel(&level))
             this->current_blevel = level;
     }
+
+    residency_enter(&level_residency, this->current_blevel);
 }
 
 /** 
@@ -768,9 +4106,18 @@ static int __init amilo_pa2548_init(void)
         goto __unsupported_device;
     }
 
+    housekeeping_init();
+
+    this_laptop->wq = create_workqueue(AMILO_PA2548_SYSTEM_NAME);
+    if (this_laptop->wq == NULL)
+    {
+        result = -ENOMEM;
+        goto __unsupported_device;
+    }
+
     this_laptop_init(this_laptop);
 
-#ifndef KERNEL_ALREADY_HAS_IT
+#ifdef HOTKEYS_SUPPORT
 
     /* ACPI driver stuff */
     
@@ -783,6 +4130,8 @@ static int __init amilo_pa2548_init(void)
 
 #endif
 
+#ifdef CONFIG_AMILO_PA2548_BACKLIGHT
+
     /* Backlight stuff */
 
     if (acpi_video_backlight_support() == 0)
@@ -810,12 +4159,14 @@ static int __init amilo_pa2548_init(void)
 
         /* Set backlight options */
         this_laptop->bl_device->props.max_brightness =
-            this_laptop->options.max_blevel;
+            laptop_options.max_blevel;
 
         lcd_get_blevel(&level);
         this_laptop->bl_device->props.brightness = level;
     }
 
+#endif
+
     /* Platform stuff */
 
     result = platform_driver_register(&pf_driver);
@@ -831,10 +4182,21 @@ static int __init amilo_pa2548_init(void)
     if (result < 0)
         goto __cannot_add_device;
 
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
     result = sysfs_create_group(&this_laptop->pf_device->dev.kobj,
                                 &pf_attribute_group);
     if (result < 0)
         goto __cannot_create_group_in_sysfs;
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_STATS
+    result = sysfs_create_group(&this_laptop->pf_device->dev.kobj,
+                                &stats_attribute_group);
+    if (result < 0)
+        goto __cannot_create_stats_group;
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_LED
 
     /* LED stuff */
 
@@ -844,14 +4206,40 @@ static int __init amilo_pa2548_init(void)
     if (result < 0)
         goto __cannot_register_led_device;
 
+    this_laptop->led_brightness = led_sm_brightness_get(&amilo_pa2548_sm_led);
+    residency_enter(&led_residency, led_sm_mode(this_laptop->led_brightness));
+
+#endif
+
+    /* Events stuff */
+
+    events_init();
+
+    /* Debugfs stuff */
+
+    debugfs_init();
+
     /* Print ok message */
     printk(KERN_INFO AMILO_PA2548_PREFIX AMILO_PA2548_SYSTEM_NAME
            " version %s loaded\n", AMILO_PA2548_VERSION);
 
     return 0;
 
+#ifdef CONFIG_AMILO_PA2548_LED
 __cannot_register_led_device:
+#endif
+#ifdef CONFIG_AMILO_PA2548_STATS
+__cannot_create_stats_group:
+#endif
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
 __cannot_create_group_in_sysfs:
+#endif
+#ifdef PROFILES_SUPPORT
+    cancel_work_sync(&this_laptop->profile_work);
+#endif
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
+    cancel_delayed_work_sync(&this_laptop->throttle.work);
+#endif
     platform_device_del(this_laptop->pf_device);
 
 __cannot_add_device:
@@ -861,14 +4249,20 @@ __cannot_allocate_device:
     platform_driver_unregister(&pf_driver);
 
 __cannot_register_platform_driver:
+#ifdef CONFIG_AMILO_PA2548_BACKLIGHT
     backlight_device_unregister(this_laptop->bl_device);
 
 __cannot_register_backlight_device:
-#ifndef KERNEL_ALREADY_HAS_IT
+#endif
+#ifdef HOTKEYS_SUPPORT
     acpi_bus_unregister_driver(&acpi_amilo_pa2548_driver);
 
 __cannot_register_acpi_driver:
 #endif
+    cancel_delayed_work_sync(&this_laptop->watchdog.probe);
+    cancel_work_sync(&this_laptop->prefetch_work);
+    destroy_workqueue(this_laptop->wq);
+
 __unsupported_device:
     kfree_s(this_laptop);
 
@@ -884,23 +4278,58 @@ static void __exit amilo_pa2548_exit(void)
     if (!this_laptop)
         return;
 
+    debugfs_exit();
+    events_exit();
+
+    /* the hotkeys and the backlight notify the platform device */
+#ifdef HOTKEYS_SUPPORT
+    acpi_bus_unregister_driver(&acpi_amilo_pa2548_driver);
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_BACKLIGHT
+    safe_do(this_laptop->bl_device,
+            backlight_device_unregister(this_laptop->bl_device));
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_LED
     led_classdev_unregister(&amilo_pa2548_sm_led);
+    /* the unregistering may only queue the final brightness, write it now */
+    cancel_work_sync(&this_laptop->led_work);
+    led_sm_write(&this_laptop->led_work);
+#endif
+
+#ifdef CONFIG_AMILO_PA2548_STATS
+    safe_do(this_laptop->pf_device,
+            sysfs_remove_group(&this_laptop->pf_device->dev.kobj,
+                               &stats_attribute_group));
+#endif
 
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
     safe_do(this_laptop->pf_device,
             sysfs_remove_group(&this_laptop->pf_device->dev.kobj,
                                &pf_attribute_group));
+#endif
+
+#ifdef PROFILES_SUPPORT
+    /*
+     * It notifies the platform device; with the events and the sysfs files
+     * gone nothing queues it any more.
+     */
+    cancel_work_sync(&this_laptop->profile_work);
+#endif
+#ifdef CONFIG_AMILO_PA2548_PLATFORM_ATTR
+    /* the folded write notifies the platform device too */
+    cancel_delayed_work_sync(&this_laptop->throttle.work);
+#endif
     
     safe_do(this_laptop->pf_device,
             platform_device_unregister(this_laptop->pf_device));
     
     platform_driver_unregister(&pf_driver);
-    
-    safe_do(this_laptop->bl_device,
-            backlight_device_unregister(this_laptop->bl_device));
-    
-#ifndef KERNEL_ALREADY_HAS_IT
-    acpi_bus_unregister_driver(&acpi_amilo_pa2548_driver);
-#endif
+
+    cancel_delayed_work_sync(&this_laptop->watchdog.probe);
+    cancel_work_sync(&this_laptop->prefetch_work);
+    destroy_workqueue(this_laptop->wq);
 
     kfree_s(this_laptop);
     /* Goodbye message */
@@ -0,0 +1,71 @@
+/*
+  Copyright (C) 2008-2009 Piotr V. Abramov <piotr.abram@gmail.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or   
+  (at your option) any later version.                                 
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of         
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  
+  General Public License for more details.                           
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software      
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA    
+  02110-1301, USA.                                                 
+*/
+
+/**
+ * @file amilo_pa2548_policy.h
+ *
+ * The interface of the brightness policy. Another module can register its
+ * own policy to decide which brightness level is set on the Fn-keys and on
+ * the requests from userspace. The driver uses its default policy when no
+ * policy is registered.
+ */
+
+#ifndef AMILO_PA2548_POLICY_H
+#define AMILO_PA2548_POLICY_H
+
+/** 
+ * @brief The sources of the brightness requests
+ */
+enum AMILO_PA2548_SOURCE
+{
+    AMILO_PA2548_SOURCE_PLATFORM = 0,   /**< The platform interface */
+    AMILO_PA2548_SOURCE_BACKLIGHT,      /**< The backlight interface */
+    AMILO_PA2548_SOURCE_PROFILE,        /**< The power source profile */
+    AMILO_PA2548_SOURCE_END
+};
+
+/** 
+ * @brief The brightness policy
+ *
+ * The callbacks are called with the brightness lock held, so they must not
+ * sleep for long and must not call back into the driver except
+ * amilo_pa2548_cached_level().
+ *
+ * The driver holds no reference to the module of the policy, the module
+ * must call amilo_pa2548_unregister_policy() in its module_exit; when it
+ * returns no callback of the policy is running any more.
+ */
+struct amilo_pa2548_policy
+{
+    const char *name;       /**< The name of the policy */
+
+    /** Returns the level for the Fn-key step 'delta' from the level 'cur' */
+    int (*on_hotkey)(int delta, int cur);
+    /** Returns the level for the 'level' requested from the 'source' */
+    int (*on_request)(int source, int level);
+    /** Returns the level which is really set instead of the 'level' */
+    int (*clamp)(int level);
+};
+
+int amilo_pa2548_register_policy(struct amilo_pa2548_policy *policy);
+void amilo_pa2548_unregister_policy(struct amilo_pa2548_policy *policy);
+
+int amilo_pa2548_cached_level(void);
+
+#endif /* AMILO_PA2548_POLICY_H */
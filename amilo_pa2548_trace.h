@@ -0,0 +1,59 @@
+/*
+  Copyright (C) 2008-2009 Piotr V. Abramov <piotr.abram@gmail.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or   
+  (at your option) any later version.                                 
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of         
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU  
+  General Public License for more details.                           
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software      
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA    
+  02110-1301, USA.                                                 
+*/
+
+/**
+ * @file amilo_pa2548_trace.h
+ *
+ * The binary format of the entry point trace. It is shared by the driver,
+ * which records the trace to the debugfs file 'trace', and by the userspace
+ * tools, which replay it.
+ */
+
+#ifndef AMILO_PA2548_TRACE_H
+#define AMILO_PA2548_TRACE_H
+
+#include <linux/types.h>
+
+/** 
+ * @brief The traced entry points
+ */
+enum AMILO_PA2548_TRACE_ENTRY
+{
+    AMILO_PA2548_TRACE_PF_STORE_LCD_LEVEL = 1,  /**< pf_store_lcd_level() */
+    AMILO_PA2548_TRACE_BL_SET_BLEVEL,           /**< bl_set_blevel() */
+    AMILO_PA2548_TRACE_ACPI_NOTIFY,             /**< acpi_driver_notify() */
+    AMILO_PA2548_TRACE_LED_SM_SET,              /**< led_sm_brightness_set() */
+    AMILO_PA2548_TRACE_PF_STORE_LCD_STATE,      /**< pf_store_lcd_state() */
+    AMILO_PA2548_TRACE_END
+};
+
+/** 
+ * @brief The trace record (16 bytes, host byte order)
+ */
+struct amilo_pa2548_trace_record
+{
+    __u64 timestamp;    /**< The monotonic time of the call in ns */
+    __u8 entry;         /**< The entry point (AMILO_PA2548_TRACE_*) */
+    __u8 reserved;      /**< Zero */
+    __s16 arg;          /**< The level of PF_STORE_LCD_STATE, zero otherwise */
+    __s32 value;        /**< The level, the event, the LED brightness or
+                             the generation of PF_STORE_LCD_STATE */
+};
+
+#endif /* AMILO_PA2548_TRACE_H */
@@ -0,0 +1,221 @@
+#!/bin/sh
+##############################################################################
+# Fujitsu-Siemens Computers Amilo Pa 2548 ACPI support driver
+#
+# ::AML PROFILER::
+#
+# Profiles the brightness methods of a captured DSDT/SSDT offline with the
+# ACPICA userspace interpreter (acpiexec). For every level in the range of
+# the model options the _BCM method is executed, _BCL once; the opcodes, the
+# operation region accesses and the wall time per call are reported. The
+# wall time is measured by the runs without the trace and the verbose
+# output, the opcodes and the accesses by one traced call.
+#
+# The batches of one call and of the repeated calls are run several times,
+# the wall time is the difference of their medians per call and the range is
+# the lowest and the highest difference of the single runs. A negative time
+# is reported as it is: the cost of the call is below the noise of the runs,
+# repeat more calls (-r) or more runs (-t).
+#
+# Capture the tables on the machine:
+#
+#   acpidump -b    (dsdt.dat, ssdt*.dat)
+#
+# Profile them anywhere:
+#
+#   tools/amilo_pa2548_amlprof.sh dsdt.dat ssdt1.dat
+#
+# The method paths and the levels are taken from the model options in
+# amilo_pa2548.c, the options below override them. The opcodes are counted
+# from the trace of the ACPICA debugger, the region accesses from the
+# verbose region handler of acpiexec; their output format differs between
+# the ACPICA versions, so the patterns can be overridden by the environment
+# variables OPCODE_PATTERN and REGION_PATTERN.
+#
+# Copyrights (c) 2008-2009 Piotr V. Abramov
+##############################################################################
+
+ACPIEXEC=${ACPIEXEC:-acpiexec}
+OPCODE_PATTERN=${OPCODE_PATTERN:-'Opcode.*Begin|Begin.*Opcode'}
+REGION_PATTERN=${REGION_PATTERN:-'(Read|Write).*(SystemIO|SystemMemory|EmbeddedControl)|(SystemIO|SystemMemory|EmbeddedControl).*(Read|Write)'}
+
+DRIVER_SOURCE="$(dirname "$0")/../amilo_pa2548.c"
+REPEATS=100
+RUNS=5
+BCM=
+BCL=
+MIN_LEVEL=
+MAX_LEVEL=
+
+usage()
+{
+    cat >&2 <<EOF
+Usage: $0 [-s source] [-m BCM] [-l BCL] [-n min] [-x max] [-r repeats]
+          [-t runs] table...
+  -s source   the driver source with the model options (default $DRIVER_SOURCE)
+  -m BCM      the path of the method which sets the level
+  -l BCL      the path of the method which lists the levels
+  -n min      the lowest level
+  -x max      the highest level
+  -r repeats  the calls of every method in the timed run (default $REPEATS)
+  -t runs     the timed runs of every batch (default $RUNS)
+EOF
+    exit 1
+}
+
+while getopts "s:m:l:n:x:r:t:" opt; do
+    case $opt in
+        s) DRIVER_SOURCE=$OPTARG ;;
+        m) BCM=$OPTARG ;;
+        l) BCL=$OPTARG ;;
+        n) MIN_LEVEL=$OPTARG ;;
+        x) MAX_LEVEL=$OPTARG ;;
+        r) REPEATS=$OPTARG ;;
+        t) RUNS=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+[ $# -gt 0 ] || usage
+[ "$REPEATS" -gt 1 ] && [ "$RUNS" -gt 0 ] || usage
+TABLES="$*"
+
+# the first model in the options of the driver
+option()
+{
+    sed -n "/model_options\[MODEL_END\]/,/^};/p" "$DRIVER_SOURCE" |
+        sed -n "s/^ *\.$1 = \"\{0,1\}\([^\",]*\)\"\{0,1\},.*/\1/p" | head -n 1 |
+        sed 's/\\\\/\\/g'
+}
+
+if [ -r "$DRIVER_SOURCE" ]; then
+    [ -n "$BCM" ] || BCM=$(option BCM)
+    [ -n "$BCL" ] || BCL=$(option BCL)
+    [ -n "$MIN_LEVEL" ] || MIN_LEVEL=$(option min_blevel)
+    [ -n "$MAX_LEVEL" ] || MAX_LEVEL=$(option max_blevel)
+fi
+
+if [ -z "$BCM" ] || [ -z "$BCL" ] || [ -z "$MIN_LEVEL" ] || [ -z "$MAX_LEVEL" ]; then
+    echo "cannot find the model options, pass them explicitly" >&2
+    usage
+fi
+
+command -v "$ACPIEXEC" > /dev/null || {
+    echo "$ACPIEXEC is not found, install the ACPICA tools" >&2
+    exit 1
+}
+
+now_ns()
+{
+    date +%s%N
+}
+
+OUTPUT=$(mktemp) || exit 1
+trap 'rm -f "$OUTPUT"' EXIT
+
+# runs the commands in one batch with the options, the output is in $OUTPUT
+# and the wall time in $WALL_NS; exits on a failure
+run()
+{
+    start=$(now_ns)
+    "$ACPIEXEC" $2 -b "$1" $TABLES > "$OUTPUT" 2>&1
+    status=$?
+    end=$(now_ns)
+
+    if grep -q "AE_NOT_FOUND" "$OUTPUT"; then
+        echo "a method is not found in the tables: $1" >&2
+        exit 1
+    fi
+
+    if [ $status -ne 0 ]; then
+        echo "$ACPIEXEC failed ($status): $1" >&2
+        exit 1
+    fi
+
+    WALL_NS=$((end - start))
+}
+
+# the commands which execute the method the given number of times
+commands()
+{
+    commands=
+    i=0
+    while [ $i -lt "$3" ]; do
+        commands="$commands${commands:+; }execute $1 $2"
+        i=$((i + 1))
+    done
+    echo "$commands"
+}
+
+# runs the commands $RUNS times, the sorted wall times are in $TIMES
+timed()
+{
+    TIMES=
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        run "$1"
+        TIMES="$TIMES $WALL_NS"
+        i=$((i + 1))
+    done
+    TIMES=$(printf "%s\n" $TIMES | sort -n)
+}
+
+# the median, the lowest and the highest of the sorted $TIMES
+median()
+{
+    printf "%s\n" $TIMES | sed -n "$(( (RUNS + 1) / 2 ))p"
+}
+
+lowest()
+{
+    printf "%s\n" $TIMES | head -n 1
+}
+
+highest()
+{
+    printf "%s\n" $TIMES | tail -n 1
+}
+
+# the difference of the wall times per call in us, it may be negative
+per_call()
+{
+    awk -v many="$1" -v once="$2" -v n="$REPEATS" \
+        'BEGIN { printf "%.1f", (many - once) / (n - 1) / 1000 }'
+}
+
+# profiles the method and prints its row
+profile()
+{
+    method=$1
+    arg=$2
+
+    # the wall time without the trace and the verbose region output, the
+    # loading of the tables is cancelled by the runs with one call
+    timed "$(commands "$method" "$arg" 1)"
+    once=$(median) once_lo=$(lowest) once_hi=$(highest)
+    timed "$(commands "$method" "$arg" "$REPEATS")"
+    many=$(median) many_lo=$(lowest) many_hi=$(highest)
+
+    wall=$(per_call $many $once)
+    range=$(per_call $many_lo $once_hi)..$(per_call $many_hi $once_lo)
+
+    # the opcodes and the region accesses of one traced call
+    run "trace method $method opcode; $(commands "$method" "$arg" 1)" -vr
+    opcodes=$(grep -Ec "$OPCODE_PATTERN" "$OUTPUT")
+    regions=$(grep -Ec "$REGION_PATTERN" "$OUTPUT")
+
+    printf "%-40s %10s %16s %10s %10s\n" "$method${arg:+($arg)}" $wall \
+           $range $opcodes $regions
+}
+
+printf "%-40s %10s %16s %10s %10s\n" "method" "wall(us)" "range(us)" \
+       "opcodes" "regions"
+
+profile "$BCL" ""
+
+level=$MIN_LEVEL
+while [ "$level" -le "$MAX_LEVEL" ]; do
+    profile "$BCM" "$level"
+    level=$((level + 1))
+done
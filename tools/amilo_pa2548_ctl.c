@@ -0,0 +1,258 @@
+/*
+  Copyright (C) 2008-2009 Piotr V. Abramov <piotr.abram@gmail.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+*/
+
+/**
+ * @file amilo_pa2548_ctl.c
+ *
+ * The command line client of the driver built on libamilo_pa2548:
+ *
+ *   amilo_pa2548_ctl get
+ *   amilo_pa2548_ctl set 5
+ *   amilo_pa2548_ctl step -2
+ *   amilo_pa2548_ctl fade 0 500
+ *   amilo_pa2548_ctl state
+ *   amilo_pa2548_ctl cas 3 42
+ *   amilo_pa2548_ctl led 255
+ *   amilo_pa2548_ctl watch
+ *   amilo_pa2548_ctl bench 10000
+ *
+ * 'bench' compares the library (persistent descriptors) with the shell way
+ * of opening lcd_level for every operation.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libamilo_pa2548.h"
+
+#define LCD_LEVEL_PATH  "/sys/devices/platform/amilo_pa2548/lcd_level"
+
+static const char *root = "";
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int watch(struct amilo_pa2548 *handle)
+{
+    struct pollfd pfd;
+    int level, status;
+
+    pfd.fd = amilo_pa2548_event_fd(handle);
+    pfd.events = POLLPRI | POLLERR;
+    if (pfd.fd < 0)
+        return pfd.fd;
+
+    for (;;)
+    {
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        status = amilo_pa2548_read_event(handle, &level);
+        if (status < 0)
+            return status;
+
+        printf("%d\n", level);
+        fflush(stdout);
+    }
+}
+
+/**
+ * Reads and writes the level the given number of times through the library
+ * and through open()/close() for every operation
+ *
+ * @param handle The handle
+ * @param count The number of operations
+ *
+ * @return The status
+ */
+static int bench(struct amilo_pa2548 *handle, long count)
+{
+    char path[256], buf[32], rbuf[32];
+    double start, lib_time, open_time;
+    int level, status, fd, len;
+    long i;
+
+    if (count <= 0)
+        return -EINVAL;
+
+    status = amilo_pa2548_get_level(handle, &level);
+    if (status < 0)
+        return status;
+
+    start = now_sec();
+    for (i = 0; i < count && status == 0; ++i)
+    {
+        status = amilo_pa2548_get_level(handle, &level);
+        if (status == 0)
+            status = amilo_pa2548_set_level(handle, level);
+    }
+    lib_time = now_sec() - start;
+    if (status < 0)
+        return status;
+
+    snprintf(path, sizeof(path), "%s%s", root, LCD_LEVEL_PATH);
+    len = snprintf(buf, sizeof(buf), "%d\n", level);
+
+    start = now_sec();
+    for (i = 0; i < count; ++i)
+    {
+        fd = open(path, O_RDONLY);
+        if (fd < 0 || read(fd, rbuf, sizeof(rbuf)) < 0)
+            return -errno;
+        close(fd);
+
+        fd = open(path, O_WRONLY);
+        if (fd < 0 || write(fd, buf, len) < 0)
+            return -errno;
+        close(fd);
+    }
+    open_time = now_sec() - start;
+
+    printf("%-10s %12s %10s\n", "method", "ops/s", "us/op");
+    printf("%-10s %12.0f %10.2f\n", "library",
+           2 * count / lib_time, lib_time * 1e6 / (2 * count));
+    printf("%-10s %12.0f %10.2f\n", "open",
+           2 * count / open_time, open_time * 1e6 / (2 * count));
+
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-r root] command [args]\n"
+            "  get                print the brightness level\n"
+            "  set LEVEL          set the brightness level\n"
+            "  step DELTA         change the brightness level by DELTA\n"
+            "  fade LEVEL MS      fade to LEVEL in MS milliseconds\n"
+            "  state              print the brightness level and its generation\n"
+            "  cas LEVEL GEN      set LEVEL if the generation is still GEN\n"
+            "  led [BRIGHTNESS]   print or set the silent mode LED\n"
+            "  watch              print the brightness level on every change\n"
+            "  bench [COUNT]      compare the library with open() per operation\n"
+            "  -r root            prefix of the driver files (default none)\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    struct amilo_pa2548 *handle;
+    const char *name = argv[0], *command;
+    int opt, level, status = -EINVAL;
+
+    while ((opt = getopt(argc, argv, "+r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': root = optarg; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    command = argv[optind++];
+    argc -= optind;
+    argv += optind;
+
+    handle = amilo_pa2548_open(root);
+    if (handle == NULL)
+    {
+        perror("amilo_pa2548_open");
+        return EXIT_FAILURE;
+    }
+
+    if (!strcmp(command, "get") && argc == 0)
+    {
+        status = amilo_pa2548_get_level(handle, &level);
+        if (status == 0)
+            printf("%d\n", level);
+    }
+    else if (!strcmp(command, "set") && argc == 1)
+        status = amilo_pa2548_set_level(handle, atoi(argv[0]));
+    else if (!strcmp(command, "step") && argc == 1)
+    {
+        status = amilo_pa2548_step(handle, atoi(argv[0]), &level);
+        if (status == 0)
+            printf("%d\n", level);
+    }
+    else if (!strcmp(command, "fade") && argc == 2)
+        status = amilo_pa2548_fade(handle, atoi(argv[0]), atoi(argv[1]));
+    else if (!strcmp(command, "state") && argc == 0)
+    {
+        unsigned int generation;
+
+        status = amilo_pa2548_get_state(handle, &level, &generation);
+        if (status == 0)
+            printf("%d %u\n", level, generation);
+    }
+    else if (!strcmp(command, "cas") && argc == 2)
+        status = amilo_pa2548_set_level_if(handle, atoi(argv[0]),
+                                           strtoul(argv[1], NULL, 0));
+    else if (!strcmp(command, "led") && argc == 0)
+    {
+        status = amilo_pa2548_get_led(handle, &level);
+        if (status == 0)
+            printf("%d\n", level);
+    }
+    else if (!strcmp(command, "led") && argc == 1)
+        status = amilo_pa2548_set_led(handle, atoi(argv[0]));
+    else if (!strcmp(command, "watch") && argc == 0)
+        status = watch(handle);
+    else if (!strcmp(command, "bench") && argc <= 1)
+        status = bench(handle, argc ? atol(argv[0]) : 10000);
+    else
+    {
+        usage(name);
+        amilo_pa2548_close(handle);
+        return EXIT_FAILURE;
+    }
+
+    amilo_pa2548_close(handle);
+
+    if (status < 0)
+    {
+        fprintf(stderr, "%s: %s\n", command, strerror(-status));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,348 @@
+/*
+  Copyright (C) 2008-2009 Piotr V. Abramov <piotr.abram@gmail.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+*/
+
+/**
+ * @file amilo_pa2548_exporter.c
+ *
+ * Exports the statistics of the driver (the platform file 'stats') in the
+ * OpenMetrics text format. Every scrape is one pread() of the kept open
+ * file, the metrics are named after its lines, so the new counters of the
+ * driver are exported without changing the tool.
+ *
+ * Print the metrics once, e.g. for the textfile collector of node_exporter:
+ *
+ *   amilo_pa2548_exporter > /var/lib/node_exporter/amilo_pa2548.prom
+ *
+ * Serve them over HTTP on /metrics:
+ *
+ *   amilo_pa2548_exporter -l 9548
+ *   amilo_pa2548_exporter -l 127.0.0.1:9548
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define STATS_PATH      "/sys/devices/platform/amilo_pa2548/stats"
+#define METRIC_PREFIX   "amilo_pa2548_"
+
+#define STATS_SIZE      4096
+#define METRICS_SIZE    16384
+
+#define CONTENT_TYPE    "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/**
+ * @brief The output buffer of the metrics
+ */
+struct output_t
+{
+    char data[METRICS_SIZE];
+    size_t len;
+};
+
+static void out(struct output_t *o, const char *format, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(o->data + o->len, sizeof(o->data) - o->len, format, args);
+    va_end(args);
+
+    if (len > 0)
+        o->len += (size_t)len < sizeof(o->data) - o->len ?
+                  (size_t)len : sizeof(o->data) - o->len - 1;
+}
+
+/**
+ * Converts the statistics of the driver to the metrics
+ *
+ * @param stats The content of the statistics file
+ * @param o The metrics
+ */
+static void convert(char *stats, struct output_t *o)
+{
+    char histogram[64] = "";
+    unsigned long long cumulative = 0;
+    char *line, *save;
+
+    o->len = 0;
+
+    for (line = strtok_r(stats, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save))
+    {
+        char type[16], name[64], arg[64];
+        unsigned long long value;
+        long long gauge;        /* the gauges are signed */
+
+        if (sscanf(line, "counter %63s %llu", name, &value) == 2)
+        {
+            out(o, "# TYPE " METRIC_PREFIX "%s counter\n", name);
+            out(o, METRIC_PREFIX "%s_total %llu\n", name, value);
+        }
+        else if (sscanf(line, "histogram %63s %63s %llu", name, arg, &value) == 3)
+        {
+            if (strcmp(histogram, name) != 0)
+            {
+                snprintf(histogram, sizeof(histogram), "%s", name);
+                cumulative = 0;
+                out(o, "# TYPE " METRIC_PREFIX "%s_seconds histogram\n", name);
+            }
+
+            cumulative += value;
+            if (strcmp(arg, "+Inf") == 0)
+                out(o, METRIC_PREFIX "%s_seconds_bucket{le=\"+Inf\"} %llu\n",
+                    name, cumulative);
+            else
+                out(o, METRIC_PREFIX "%s_seconds_bucket{le=\"%g\"} %llu\n",
+                    name, strtoull(arg, NULL, 10) / 1e6, cumulative);
+        }
+        else if (sscanf(line, "sum %63s %llu", name, &value) == 2)
+        {
+            out(o, METRIC_PREFIX "%s_seconds_count %llu\n", name,
+                strcmp(histogram, name) == 0 ? cumulative : 0);
+            out(o, METRIC_PREFIX "%s_seconds_sum %g\n", name, value / 1e6);
+        }
+        else if (sscanf(line, "gauge %63s %lld", name, &gauge) == 2)
+        {
+            out(o, "# TYPE " METRIC_PREFIX "%s gauge\n", name);
+            out(o, METRIC_PREFIX "%s %lld\n", name, gauge);
+        }
+        else if (sscanf(line, "info %63s %63s", name, arg) == 2)
+        {
+            out(o, "# TYPE " METRIC_PREFIX "%s info\n", name);
+            out(o, METRIC_PREFIX "%s_info{%s=\"%s\"} 1\n", name, name, arg);
+        }
+        else if (sscanf(line, "%15s", type) == 1)
+            fprintf(stderr, "unknown statistics line: %s\n", line);
+    }
+
+    out(o, "# EOF\n");
+}
+
+/**
+ * Reads the statistics and converts them to the metrics
+ *
+ * @param fd The statistics file
+ * @param o The metrics
+ *
+ * @return Zero or -1 on error
+ */
+static int scrape(int fd, struct output_t *o)
+{
+    char stats[STATS_SIZE];
+    ssize_t len;
+
+    len = pread(fd, stats, sizeof(stats) - 1, 0);
+    if (len < 0)
+    {
+        perror("stats");
+        return -1;
+    }
+    stats[len] = '\0';
+
+    convert(stats, o);
+
+    return 0;
+}
+
+static void send_all(int sock, const char *data, size_t len)
+{
+    ssize_t sent;
+
+    while (len > 0)
+    {
+        sent = send(sock, data, len, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return;
+        data += sent;
+        len -= sent;
+    }
+}
+
+/**
+ * Serves one HTTP request
+ *
+ * @param sock The client socket
+ * @param fd The statistics file
+ */
+static void serve_client(int sock, int fd)
+{
+    static struct output_t o;
+    char request[1024], header[256];
+    ssize_t len;
+    int hlen;
+
+    len = recv(sock, request, sizeof(request) - 1, 0);
+    if (len <= 0)
+        return;
+    request[len] = '\0';
+
+    if (strncmp(request, "GET /metrics ", 13) != 0 &&
+        strncmp(request, "GET / ", 6) != 0)
+    {
+        static const char not_found[] =
+            "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        send_all(sock, not_found, sizeof(not_found) - 1);
+        return;
+    }
+
+    if (scrape(fd, &o) < 0)
+    {
+        static const char failed[] =
+            "HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+        send_all(sock, failed, sizeof(failed) - 1);
+        return;
+    }
+
+    hlen = snprintf(header, sizeof(header),
+                    "HTTP/1.0 200 OK\r\nContent-Type: " CONTENT_TYPE "\r\n"
+                    "Content-Length: %zu\r\n\r\n", o.len);
+    send_all(sock, header, hlen);
+    send_all(sock, o.data, o.len);
+}
+
+/**
+ * Serves the metrics over HTTP until killed
+ *
+ * @param listen_addr The address "[host:]port"
+ * @param fd The statistics file
+ *
+ * @return The exit code
+ */
+static int serve(const char *listen_addr, int fd)
+{
+    struct sockaddr_in addr;
+    struct timeval timeout = { 1, 0 };
+    const char *port = strrchr(listen_addr, ':');
+    char host[64] = "0.0.0.0";
+    int sock, client, on = 1;
+
+    if (port)
+    {
+        snprintf(host, sizeof(host), "%.*s", (int)(port - listen_addr),
+                 listen_addr);
+        port++;
+    }
+    else
+        port = listen_addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(port));
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad address: %s\n", listen_addr);
+        return EXIT_FAILURE;
+    }
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+        bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(sock, 16) < 0)
+    {
+        perror(listen_addr);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    for (;;)
+    {
+        client = accept(sock, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            return EXIT_FAILURE;
+        }
+
+        /* a stalled scraper must not block the next ones */
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        serve_client(client, fd);
+        close(client);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-l [host:]port] [-r root]\n"
+            "  -l [host:]port  serve the metrics over HTTP (default print once)\n"
+            "  -r root         prefix of the driver files (default none)\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct output_t o;
+    const char *listen_addr = NULL;
+    const char *root = "";
+    char path[256];
+    int opt, fd, status;
+
+    while ((opt = getopt(argc, argv, "l:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': listen_addr = optarg; break;
+            case 'r': root = optarg; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    snprintf(path, sizeof(path), "%s%s", root, STATS_PATH);
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    if (listen_addr)
+        return serve(listen_addr, fd);
+
+    status = scrape(fd, &o);
+    if (status == 0)
+        fwrite(o.data, 1, o.len, stdout);
+
+    close(fd);
+
+    return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
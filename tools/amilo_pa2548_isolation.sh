@@ -0,0 +1,207 @@
+#!/bin/sh
+##############################################################################
+# Fujitsu-Siemens Computers Amilo Pa 2548 ACPI support driver
+#
+# ::ISOLATION CHECK::
+#
+# Checks that the deferred work of the driver does not run on the isolated
+# CPUs. The load runs on the isolated CPUs, so the driver queues its works
+# from there: it writes the LED (led_sm_write), stores the profile levels
+# back (profile_apply), writes lcd_level and lcd_state, and bursts the
+# lcd_level writes with write_rate lowered to 1, so they are folded
+# (throttle_apply). The function tracer records only the work functions,
+# the tracing stays on until the queue is drained, and any call on an
+# isolated CPU fails the check. The check fails too if no work ran at all,
+# it would prove nothing. lcd_prefetch and watchdog_probe run only after
+# the lid, AC and resume events and a backend failover, they are listed as
+# not exercised unless such an event comes during the load.
+#
+# The isolated CPUs are taken from isolcpus= of the kernel command line or
+# /sys/devices/system/cpu/isolated (from 2.6.36), otherwise pass them by -i.
+# The write_rate, write_burst and the brightness level are restored at the
+# end.
+#
+# Run it as root on the machine or in QEMU with the module loaded with the
+# matching housekeeping_cpus, e.g. for "isolcpus=2-3 nohz_full=2-3":
+#
+#   modprobe amilo_pa2548 housekeeping_cpus=0-1
+#   tools/amilo_pa2548_isolation.sh -d 30
+#
+# Copyrights (c) 2008-2009 Piotr V. Abramov
+##############################################################################
+
+MODULE=amilo_pa2548
+PLATFORM=/sys/devices/platform/$MODULE
+PARAMS=/sys/module/$MODULE/parameters
+LED=/sys/class/leds/$MODULE::silentmode/brightness
+TRACING=/sys/kernel/debug/tracing
+
+ISOLATED=
+LOAD_CPUS=
+DURATION=10
+DRAIN=3
+
+# the works of the driver, the compiled out ones are skipped
+WORKS="lcd_prefetch profile_apply throttle_apply led_sm_write watchdog_probe"
+
+usage()
+{
+    cat >&2 <<EOF
+Usage: $0 [-i cpus] [-l cpus] [-d seconds] [-w seconds]
+  -i cpus     the isolated CPUs (default isolcpus= of the command line)
+  -l cpus     the CPUs of the load (default the isolated CPUs)
+  -d seconds  the duration of the load (default $DURATION)
+  -w seconds  the tracing after the load until the works are drained
+              (default $DRAIN)
+EOF
+    exit 1
+}
+
+while getopts "i:l:d:w:" opt; do
+    case $opt in
+        i) ISOLATED=$OPTARG ;;
+        l) LOAD_CPUS=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        w) DRAIN=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+
+# "isolcpus=domain,2-3" -> "2-3", the flags are from the later kernels
+[ -n "$ISOLATED" ] || ISOLATED=$(tr ' ' '\n' < /proc/cmdline |
+    sed -n 's/^isolcpus=//p' | tail -n 1 | tr ',' '\n' | grep '^[0-9]' |
+    paste -s -d , -)
+[ -n "$ISOLATED" ] || ISOLATED=$(cat /sys/devices/system/cpu/isolated 2>/dev/null)
+[ -n "$ISOLATED" ] || {
+    echo "no isolated CPUs, pass them by -i" >&2
+    usage
+}
+[ -n "$LOAD_CPUS" ] || LOAD_CPUS=$ISOLATED
+
+[ -d "$TRACING" ] || mount -t debugfs nodev /sys/kernel/debug 2>/dev/null
+[ -w "$TRACING/current_tracer" ] || {
+    echo "the function tracer is not available" >&2
+    exit 1
+}
+
+# "0-2,5" -> "0 1 2 5"
+expand()
+{
+    echo "$1" | tr ',' '\n' | while IFS=- read first last; do
+        seq "$first" "${last:-$first}"
+    done | tr '\n' ' '
+}
+
+SAVED_RATE=$(cat "$PARAMS/write_rate" 2>/dev/null)
+SAVED_BURST=$(cat "$PARAMS/write_burst" 2>/dev/null)
+SAVED_LEVEL=$(cat "$PLATFORM/lcd_level" 2>/dev/null)
+
+cleanup()
+{
+    echo 0 > "$TRACING/tracing_on"
+    echo nop > "$TRACING/current_tracer"
+    echo > "$TRACING/set_ftrace_filter"
+
+    [ -z "$SAVED_RATE" ] || echo "$SAVED_RATE" > "$PARAMS/write_rate"
+    [ -z "$SAVED_BURST" ] || echo "$SAVED_BURST" > "$PARAMS/write_burst"
+    [ -z "$SAVED_LEVEL" ] || echo "$SAVED_LEVEL" > "$PLATFORM/lcd_level"
+}
+trap cleanup EXIT INT TERM
+
+echo 0 > "$TRACING/tracing_on"
+echo function > "$TRACING/current_tracer"
+echo > "$TRACING/set_ftrace_filter"
+traced=
+for work in $WORKS; do
+    echo "$work:mod:$MODULE" >> "$TRACING/set_ftrace_filter" 2>/dev/null &&
+        traced="$traced $work"
+done
+[ -n "$traced" ] || {
+    echo "cannot trace the works of the module $MODULE, is it loaded?" >&2
+    exit 1
+}
+# one admitted write a second, the rest of a burst is folded
+[ -z "$SAVED_RATE" ] || echo 1 > "$PARAMS/write_rate"
+[ -z "$SAVED_BURST" ] || echo 1 > "$PARAMS/write_burst"
+
+echo > "$TRACING/trace"
+echo 1 > "$TRACING/tracing_on"
+
+LOAD='
+end=$(($(date +%s) + DURATION))
+level=0
+while [ $(date +%s) -lt $end ]; do
+    # the plain and the conditional writes, the throttled ones fail
+    echo $level > $PLATFORM/lcd_level 2>/dev/null
+    state=$(cat $PLATFORM/lcd_state)
+    echo $level@${state#*@} > $PLATFORM/lcd_state 2>/dev/null
+
+    # a burst, its last write is set later by throttle_apply
+    i=0
+    while [ $i -lt 4 ]; do
+        echo $(((level + i) % 8)) > $PLATFORM/lcd_level 2>/dev/null
+        i=$((i + 1))
+    done
+
+    echo $((level % 2 * 255)) > "$LED" 2>/dev/null
+
+    # the stored profile levels are kept, every store runs profile_apply
+    for profile in ac_level battery_level; do
+        [ -w $PLATFORM/$profile ] || continue
+        value=$(cat $PLATFORM/$profile)
+        echo $value > $PLATFORM/$profile
+    done
+
+    level=$(((level + 1) % 8))
+done
+'
+
+taskset -c "$LOAD_CPUS" env PLATFORM="$PLATFORM" LED="$LED" \
+    DURATION="$DURATION" sh -c "$LOAD" || {
+    echo "cannot run the load on the CPUs $LOAD_CPUS" >&2
+    exit 1
+}
+
+# the works queued by the load run after it, keep tracing them
+sleep "$DRAIN"
+echo 0 > "$TRACING/tracing_on"
+
+RESULT=/tmp/$MODULE.isolation.$$
+
+# "calls cpu work" for every work on every CPU
+grep -v '^#' "$TRACING/trace" |
+    sed -n 's/.*\[\([0-9][0-9]*\)\].* \([a-z_][a-z_0-9]*\) *<-.*/\1 \2/p' |
+    sed 's/^0*\([0-9]\)/\1/' | sort -n | uniq -c > "$RESULT"
+
+failed=0
+total=0
+printf "%-6s %-20s %10s\n" "cpu" "work" "calls"
+while read calls cpu work; do
+    mark=
+    for isolated in $(expand "$ISOLATED"); do
+        if [ "$cpu" = "$isolated" ]; then
+            mark=" isolated"
+            failed=1
+        fi
+    done
+    total=$((total + calls))
+    printf "%-6s %-20s %10s%s\n" "$cpu" "$work" "$calls" "$mark"
+done < "$RESULT"
+
+for work in $traced; do
+    grep -q " $work\$" "$RESULT" ||
+        printf "%-6s %-20s %10s not exercised\n" "-" "$work" 0
+done
+rm -f "$RESULT"
+
+if [ $total -eq 0 ]; then
+    echo "FAILED: no work of the driver ran (traced:$traced), nothing is checked"
+    exit 1
+fi
+
+if [ $failed -ne 0 ]; then
+    echo "FAILED: the works of the driver run on the isolated CPUs $ISOLATED"
+    exit 1
+fi
+
+echo "PASSED: $total work calls, none on the isolated CPUs $ISOLATED"
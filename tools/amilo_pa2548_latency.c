@@ -0,0 +1,314 @@
+/*
+  Copyright (C) 2008-2009 Piotr V. Abramov <piotr.abram@gmail.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+*/
+
+/**
+ * @file amilo_pa2548_latency.c
+ *
+ * Measures the scheduling latency which the driver adds to other tasks, the
+ * way cyclictest does. Every measurement thread runs with SCHED_FIFO on its
+ * CPU and sleeps until the next period with clock_nanosleep(TIMER_ABSTIME),
+ * the latency is the time from the planned wakeup to the actual one.
+ *
+ * The measurement runs twice: without load and while the load threads write
+ * lcd_level and the LED brightness as fast as they can. The difference of
+ * the worst cases is the latency added by the driver.
+ *
+ *   amilo_pa2548_latency -d 60 -i 1000 -p 80 -m wl
+ *
+ * Run it as root (SCHED_FIFO, mlockall) on an otherwise idle system.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libamilo_pa2548.h"
+
+#define MAX_THREADS     64
+#define NSEC_PER_SEC    1000000000LL
+
+/**
+ * @brief The state of the measurement thread
+ */
+struct measure_t
+{
+    pthread_t thread;
+    int cpu;
+    long samples;
+    long long min_ns;
+    long long max_ns;
+    long long sum_ns;
+};
+
+/**
+ * @brief The state of the load thread
+ */
+struct load_t
+{
+    pthread_t thread;
+    char role;              /**< 'w' - lcd_level, 'l' - LED */
+    long ops;
+    long errors;
+};
+
+static const char *root = "";
+static unsigned int interval_us = 1000;
+static int priority = 80;
+static int running;     /**< Accessed atomically */
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void *measure_main(void *arg)
+{
+    struct measure_t *m = arg;
+    struct sched_param param = { .sched_priority = priority };
+    struct timespec next;
+    cpu_set_t cpus;
+    long long latency;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(m->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+        fprintf(stderr, "cpu %d: cannot set SCHED_FIFO, the results are "
+                "not meaningful\n", m->cpu);
+
+    m->min_ns = -1;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (__atomic_load_n(&running, __ATOMIC_RELAXED))
+    {
+        next.tv_nsec += interval_us * 1000L;
+        while (next.tv_nsec >= NSEC_PER_SEC)
+        {
+            next.tv_nsec -= NSEC_PER_SEC;
+            next.tv_sec++;
+        }
+
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0)
+            continue;
+
+        latency = now_ns() - (next.tv_sec * NSEC_PER_SEC + next.tv_nsec);
+
+        m->samples++;
+        m->sum_ns += latency;
+        if (m->min_ns < 0 || latency < m->min_ns)
+            m->min_ns = latency;
+        if (latency > m->max_ns)
+            m->max_ns = latency;
+    }
+
+    return NULL;
+}
+
+static void *load_main(void *arg)
+{
+    struct load_t *l = arg;
+    struct amilo_pa2548 *handle;
+    int max_level, value = 0;
+
+    handle = amilo_pa2548_open(root);
+    if (handle == NULL)
+    {
+        l->errors++;
+        return NULL;
+    }
+
+    max_level = amilo_pa2548_max_level(handle);
+
+    while (__atomic_load_n(&running, __ATOMIC_RELAXED))
+    {
+        int status;
+
+        if (l->role == 'w')
+        {
+            status = amilo_pa2548_set_level(handle, value);
+            value = (value + 1) % (max_level + 1);
+        }
+        else
+        {
+            status = amilo_pa2548_set_led(handle, value);
+            value = (value == 255) ? 0 : 255;
+        }
+
+        if (status < 0)
+            l->errors++;
+        else
+            l->ops++;
+    }
+
+    amilo_pa2548_close(handle);
+
+    return NULL;
+}
+
+/**
+ * Runs the measurement threads (and the load threads) for the given time
+ *
+ * @param name The name of the phase
+ * @param measures The measurement threads
+ * @param count The number of the measurement threads
+ * @param load The load roles, empty for none
+ * @param duration The duration in seconds
+ *
+ * @return The worst latency in ns or -1 on error
+ */
+static long long run_phase(const char *name, struct measure_t *measures,
+                           int count, const char *load, unsigned int duration)
+{
+    struct load_t loads[MAX_THREADS];
+    int load_count = strlen(load);
+    long long worst = 0;
+    int i;
+
+    memset(loads, 0, sizeof(loads));
+    for (i = 0; i < count; ++i)
+    {
+        measures[i].samples = 0;
+        measures[i].max_ns = 0;
+        measures[i].sum_ns = 0;
+    }
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELAXED);
+
+    for (i = 0; i < count; ++i)
+        if (pthread_create(&measures[i].thread, NULL, measure_main,
+                           &measures[i]) != 0)
+            return -1;
+
+    for (i = 0; i < load_count; ++i)
+    {
+        loads[i].role = load[i];
+        if (pthread_create(&loads[i].thread, NULL, load_main, &loads[i]) != 0)
+            return -1;
+    }
+
+    sleep(duration);
+    __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+
+    for (i = 0; i < count; ++i)
+        pthread_join(measures[i].thread, NULL);
+    for (i = 0; i < load_count; ++i)
+        pthread_join(loads[i].thread, NULL);
+
+    for (i = 0; i < count; ++i)
+    {
+        struct measure_t *m = &measures[i];
+
+        printf("%-6s %4d %10ld %10.1f %10.1f %10.1f\n", name, m->cpu,
+               m->samples, m->min_ns / 1e3,
+               m->samples ? (double)m->sum_ns / m->samples / 1e3 : 0.0,
+               m->max_ns / 1e3);
+
+        if (m->max_ns > worst)
+            worst = m->max_ns;
+    }
+
+    for (i = 0; i < load_count; ++i)
+        printf("%-6s load %c: %ld ops/s, %ld errors\n", name, loads[i].role,
+               loads[i].ops / duration, loads[i].errors);
+
+    return worst;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-d seconds] [-i us] [-p prio] [-t threads] "
+            "[-m roles] [-r root]\n"
+            "  -d seconds  duration of every phase (default 10)\n"
+            "  -i us       wakeup interval of the measurement (default 1000)\n"
+            "  -p prio     SCHED_FIFO priority of the measurement (default 80)\n"
+            "  -t threads  measurement threads, one per CPU (default CPUs)\n"
+            "  -m roles    load threads: w - lcd_level, l - LED (default wl)\n"
+            "  -r root     prefix of the driver files (default none)\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct measure_t measures[MAX_THREADS];
+    const char *load = "wl";
+    unsigned int duration = 10;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = cpus > 0 ? (int)cpus : 1;
+    long long idle_worst, load_worst;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "d:i:p:t:m:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd': duration = atoi(optarg); break;
+            case 'i': interval_us = atoi(optarg); break;
+            case 'p': priority = atoi(optarg); break;
+            case 't': count = atoi(optarg); break;
+            case 'm': load = optarg; break;
+            case 'r': root = optarg; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc || duration == 0 || interval_us == 0 || count <= 0 ||
+        count > MAX_THREADS || strlen(load) > MAX_THREADS ||
+        strspn(load, "wl") != strlen(load))
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        perror("mlockall");
+
+    for (i = 0; i < count; ++i)
+        measures[i].cpu = i % (cpus > 0 ? cpus : 1);
+
+    printf("%-6s %4s %10s %10s %10s %10s\n", "phase", "cpu", "samples",
+           "min(us)", "avg(us)", "max(us)");
+
+    idle_worst = run_phase("idle", measures, count, "", duration);
+    load_worst = run_phase("load", measures, count, load, duration);
+    if (idle_worst < 0 || load_worst < 0)
+    {
+        fprintf(stderr, "cannot create the threads\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("worst case added by the driver: %.1f us\n",
+           (load_worst - idle_worst) / 1e3);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,401 @@
+/*
+  Copyright (C) 2008-2009 Piotr V. Abramov <piotr.abram@gmail.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+*/
+
+/**
+ * @file amilo_pa2548_replay.c
+ *
+ * Replays a trace recorded by the driver (debugfs file 'trace') against the
+ * userspace interfaces of the loaded driver.
+ *
+ * Record a workload:
+ *
+ *   echo 2 > /sys/module/amilo_pa2548/parameters/features
+ *   cat /sys/kernel/debug/amilo_pa2548/trace > workload.trace
+ *
+ * Replay it at the original speed (-s 1), accelerated (-s 10) or as fast as
+ * possible (-s 0), or only print it (-d):
+ *
+ *   amilo_pa2548_replay -s 10 workload.trace
+ *
+ * The conditional writes of lcd_state are replayed as conditional writes:
+ * the recorded generations are shifted by the difference between the live
+ * generation and the recorded one of the first such write, so a write which
+ * lost its race when recorded may win or lose again when replayed.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../amilo_pa2548_trace.h"
+
+#define NSEC_PER_SEC    1000000000LL
+
+/**
+ * @brief The replay target of the traced entry point
+ */
+struct target_t
+{
+    const char *name;   /**< The name of the entry point */
+    const char *path;   /**< The file which leads to the entry point */
+    const char *format; /**< The format of the written value */
+    int fd;             /**< The opened file, -1 if not opened yet */
+    long calls;         /**< The number of replayed calls */
+    long errors;        /**< The number of failed calls */
+    long long sum_ns;   /**< The sum of call latencies */
+    long long max_ns;   /**< The max call latency */
+};
+
+static struct target_t targets[AMILO_PA2548_TRACE_END] = {
+    [AMILO_PA2548_TRACE_PF_STORE_LCD_LEVEL] = {
+        "pf_store_lcd_level",
+        "/sys/devices/platform/amilo_pa2548/lcd_level", "%d\n", -1
+    },
+    [AMILO_PA2548_TRACE_BL_SET_BLEVEL] = {
+        "bl_set_blevel",
+        "/sys/class/backlight/amilo_pa2548/brightness", "%d\n", -1
+    },
+    [AMILO_PA2548_TRACE_ACPI_NOTIFY] = {
+        "acpi_driver_notify",
+        "/sys/kernel/debug/amilo_pa2548/hotkey_inject", "0x%x\n", -1
+    },
+    [AMILO_PA2548_TRACE_LED_SM_SET] = {
+        "led_sm_brightness_set",
+        "/sys/class/leds/amilo_pa2548::silentmode/brightness", "%d\n", -1
+    },
+    [AMILO_PA2548_TRACE_PF_STORE_LCD_STATE] = {
+        "pf_store_lcd_state",
+        "/sys/devices/platform/amilo_pa2548/lcd_state", "%d@%u\n", -1
+    },
+};
+
+static int generation_mapped;           /**< The delta below is known */
+static unsigned int generation_delta;   /**< The live minus recorded one */
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_until_ns(long long deadline)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / NSEC_PER_SEC;
+    ts.tv_nsec = deadline % NSEC_PER_SEC;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/**
+ * Loads the whole trace
+ *
+ * @param path The trace file
+ * @param count The number of loaded records
+ *
+ * @return The records or NULL on error
+ */
+static struct amilo_pa2548_trace_record *load_trace(const char *path,
+                                                    size_t *count)
+{
+    struct amilo_pa2548_trace_record *records = NULL;
+    size_t allocated = 0;
+    FILE *file;
+
+    *count = 0;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    for (;;)
+    {
+        if (*count == allocated)
+        {
+            struct amilo_pa2548_trace_record *grown;
+
+            allocated = allocated ? allocated * 2 : 1024;
+            grown = realloc(records, allocated * sizeof(*records));
+            if (grown == NULL)
+            {
+                fprintf(stderr, "Out of memory\n");
+                free(records);
+                records = NULL;
+                *count = 0;
+                break;
+            }
+            records = grown;
+        }
+
+        if (fread(&records[*count], sizeof(*records), 1, file) != 1)
+            break;
+
+        (*count)++;
+    }
+
+    fclose(file);
+
+    return records;
+}
+
+static void dump_trace(const struct amilo_pa2548_trace_record *records,
+                       size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+    {
+        const struct amilo_pa2548_trace_record *r = &records[i];
+        const char *name = "unknown";
+
+        if (r->entry < AMILO_PA2548_TRACE_END && targets[r->entry].name)
+            name = targets[r->entry].name;
+
+        if (r->entry == AMILO_PA2548_TRACE_PF_STORE_LCD_STATE)
+            printf("%12.6f %-24s %d@%u\n",
+                   (double)(r->timestamp - records[0].timestamp) /
+                   NSEC_PER_SEC, name, r->arg, (unsigned int)r->value);
+        else
+            printf("%12.6f %-24s %d\n",
+                   (double)(r->timestamp - records[0].timestamp) /
+                   NSEC_PER_SEC, name, r->value);
+    }
+}
+
+/**
+ * Maps the recorded generations to the live ones on the first conditional
+ * write
+ *
+ * @param target The lcd_state target
+ * @param recorded The generation of the first recorded conditional write
+ *
+ * @return Zero or -1 on error
+ */
+static int map_generation(const struct target_t *target, unsigned int recorded)
+{
+    unsigned int live;
+    char buf[32];
+    ssize_t len;
+    int level;
+    int fd;
+
+    fd = open(target->path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(target->path);
+        return -1;
+    }
+
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if (len <= 0)
+        return -1;
+
+    buf[len] = '\0';
+    if (sscanf(buf, "%d@%u", &level, &live) != 2)
+        return -1;
+
+    generation_delta = live - recorded;
+    generation_mapped = 1;
+
+    return 0;
+}
+
+/**
+ * Replays one record
+ *
+ * @param record The record
+ *
+ * @return Zero or -1 on error
+ */
+static int replay_record(const struct amilo_pa2548_trace_record *record)
+{
+    struct target_t *target;
+    char buf[32];
+    long long start, latency;
+    int len;
+    ssize_t status;
+
+    if (record->entry >= AMILO_PA2548_TRACE_END ||
+        targets[record->entry].path == NULL)
+        return -1;
+
+    target = &targets[record->entry];
+
+    if (target->fd == -1)
+    {
+        target->fd = open(target->path, O_WRONLY);
+        if (target->fd < 0)
+        {
+            perror(target->path);
+            target->fd = -2;    /* do not try again */
+        }
+    }
+
+    if (target->fd < 0)
+    {
+        target->errors++;
+        return -1;
+    }
+
+    if (record->entry == AMILO_PA2548_TRACE_PF_STORE_LCD_STATE)
+    {
+        if (!generation_mapped &&
+            map_generation(target, (unsigned int)record->value) < 0)
+        {
+            target->errors++;
+            return -1;
+        }
+
+        len = snprintf(buf, sizeof(buf), target->format, record->arg,
+                       (unsigned int)record->value + generation_delta);
+    }
+    else
+    {
+        len = snprintf(buf, sizeof(buf), target->format, record->value);
+    }
+
+    start = now_ns();
+    status = pwrite(target->fd, buf, len, 0);
+    latency = now_ns() - start;
+
+    target->calls++;
+    target->sum_ns += latency;
+    if (latency > target->max_ns)
+        target->max_ns = latency;
+
+    if (status < 0)
+    {
+        target->errors++;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-s speed] [-d] trace\n"
+            "  -s speed  replay speed factor (1 - original, 0 - no delays)\n"
+            "  -d        print the trace instead of replaying it\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    struct amilo_pa2548_trace_record *records;
+    size_t count, i;
+    double speed = 1.0;
+    int dump = 0;
+    long long start, lag, max_lag = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:d")) != -1)
+    {
+        switch (opt)
+        {
+            case 's':
+                speed = atof(optarg);
+                break;
+
+            case 'd':
+                dump = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1 || speed < 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    records = load_trace(argv[optind], &count);
+    if (records == NULL)
+        return EXIT_FAILURE;
+
+    if (dump)
+    {
+        dump_trace(records, count);
+        free(records);
+        return EXIT_SUCCESS;
+    }
+
+    start = now_ns();
+
+    for (i = 0; i < count; ++i)
+    {
+        if (speed > 0)
+        {
+            long long offset = (long long)
+                ((records[i].timestamp - records[0].timestamp) / speed);
+
+            sleep_until_ns(start + offset);
+
+            lag = now_ns() - (start + offset);
+            if (lag > max_lag)
+                max_lag = lag;
+        }
+
+        replay_record(&records[i]);
+    }
+
+    printf("replayed %zu records in %.3f s (speed %g, max lag %lld us)\n",
+           count, (double)(now_ns() - start) / NSEC_PER_SEC, speed,
+           max_lag / 1000);
+    printf("%-24s %8s %8s %10s %10s\n",
+           "entry", "calls", "errors", "avg_us", "max_us");
+
+    for (i = 0; i < AMILO_PA2548_TRACE_END; ++i)
+    {
+        struct target_t *target = &targets[i];
+
+        if (target->name == NULL)
+            continue;
+
+        printf("%-24s %8ld %8ld %10.1f %10.1f\n", target->name,
+               target->calls, target->errors,
+               target->calls ? target->sum_ns / 1000.0 / target->calls : 0.0,
+               target->max_ns / 1000.0);
+
+        if (target->fd >= 0)
+            close(target->fd);
+    }
+
+    free(records);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,452 @@
+/*
+  Copyright (C) 2008-2009 Piotr V. Abramov <piotr.abram@gmail.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+*/
+
+/**
+ * @file amilo_pa2548_stress.c
+ *
+ * Concurrency stress test of the loaded driver. For every thread count it
+ * runs readers, writers, Fn-key injectors and LED setters concurrently for
+ * the given time and checks the invariants:
+ *
+ * - every read level is a number in the range 0..7 (a torn index/data port
+ *   sequence shows up as an out-of-range or garbage value);
+ * - the final level is the last write in the order of the driver: the
+ *   writers set the level conditionally through lcd_state
+ *   ("level@generation"), so every successful write is tagged by the
+ *   generation it replaced and the final state must be the write with the
+ *   highest tag, one generation later; the Fn-key injectors stop at three
+ *   quarters of the round, so the writers have the last word (this assumes
+ *   the default brightness policy and no write throttling);
+ * - a level written after the run is read back.
+ *
+ * The throughput of every role is reported for every thread count.
+ *
+ *   amilo_pa2548_stress -t 1,2,4,8 -d 5 -m rwnl
+ *
+ * The tool itself can be built with -fsanitize=thread:
+ *
+ *   make tools TOOLS_CFLAGS="-O1 -g -Wall -fsanitize=thread"
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_LEVEL       0
+#define MAX_LEVEL       7
+
+#define MAX_THREADS     256
+
+/**
+ * @brief The roles of the stress threads
+ */
+enum ROLE
+{
+    ROLE_READ = 0,
+    ROLE_WRITE,
+    ROLE_NOTIFY,
+    ROLE_LED,
+    ROLE_END
+};
+
+static const char *role_names[ROLE_END] = { "read", "write", "notify", "led" };
+static const char role_keys[ROLE_END] = { 'r', 'w', 'n', 'l' };
+
+static const char *role_paths[ROLE_END] = {
+    "/sys/devices/platform/amilo_pa2548/lcd_level",
+    "/sys/devices/platform/amilo_pa2548/lcd_state",
+    "/sys/kernel/debug/amilo_pa2548/hotkey_inject",
+    "/sys/class/leds/amilo_pa2548::silentmode/brightness",
+};
+
+/**
+ * @brief The state of the stress thread
+ */
+struct worker_t
+{
+    pthread_t thread;
+    enum ROLE role;
+    unsigned int seed;
+    long ops;               /**< The number of done operations */
+    long errors;            /**< The number of failed operations */
+    long violations;        /**< The number of broken invariants */
+    int last_written;       /**< The last level written by the writer */
+    unsigned int last_generation; /**< The generation replaced by it */
+};
+
+/** The LED values, LED_OFF, a middle one and LED_FULL */
+static const int led_values[] = { 0, 127, 255 };
+
+static const char *root = "";
+static int running;     /**< Accessed atomically */
+static int injecting;   /**< Whether the Fn-key injectors run, atomically */
+
+static int open_role(enum ROLE role, int flags)
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s%s", root, role_paths[role]);
+
+    return open(path, flags);
+}
+
+static int read_level(int fd, int *level)
+{
+    char buf[32];
+    char *end;
+    ssize_t len;
+
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0)
+        return -1;
+    buf[len] = '\0';
+
+    *level = strtol(buf, &end, 10);
+    if (end == buf || (*end != '\n' && *end != '\0'))
+        return 1;
+
+    return 0;
+}
+
+static int read_state(int fd, int *level, unsigned int *generation)
+{
+    char buf[32];
+    ssize_t len;
+
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0)
+        return -1;
+    buf[len] = '\0';
+
+    return sscanf(buf, "%d@%u", level, generation) == 2 ? 0 : 1;
+}
+
+static int write_value(int fd, const char *format, int value)
+{
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), format, value);
+
+    return pwrite(fd, buf, len, 0) == len ? 0 : -1;
+}
+
+static int write_state(int fd, int level, unsigned int generation)
+{
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%d@%u\n", level, generation);
+
+    return pwrite(fd, buf, len, 0) == len ? 0 : -1;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker_t *w = arg;
+    int fd;
+    int level;
+    unsigned int generation;
+
+    fd = open_role(w->role, w->role == ROLE_READ ? O_RDONLY :
+                            w->role == ROLE_WRITE ? O_RDWR : O_WRONLY);
+    if (fd < 0)
+    {
+        w->errors++;
+        return NULL;
+    }
+
+    while (__atomic_load_n(w->role == ROLE_NOTIFY ? &injecting : &running,
+                           __ATOMIC_RELAXED))
+    {
+        int status = 0;
+
+        switch (w->role)
+        {
+            case ROLE_READ:
+                status = read_level(fd, &level);
+                if (status > 0 || (status == 0 &&
+                    (level < MIN_LEVEL || level > MAX_LEVEL)))
+                {
+                    w->violations++;
+                    status = 0;
+                }
+                break;
+
+            case ROLE_WRITE:
+                status = read_state(fd, &level, &generation);
+                if (status != 0)
+                {
+                    w->violations += status > 0;
+                    break;
+                }
+
+                level = MIN_LEVEL + rand_r(&w->seed) % (MAX_LEVEL - MIN_LEVEL + 1);
+                status = write_state(fd, level, generation);
+                if (status == 0)
+                {
+                    w->last_written = level;
+                    w->last_generation = generation;
+                }
+                else if (errno == EAGAIN)
+                    status = 0;     /* another writer was first */
+                break;
+
+            case ROLE_NOTIFY:
+                /* the steps past the borders are clamped by the policy */
+                write_value(fd, "0x%x\n", rand_r(&w->seed) & 1 ? 0x86 : 0x87);
+                break;
+
+            case ROLE_LED:
+                status = write_value(fd, "%d\n", led_values[rand_r(&w->seed) %
+                                     (sizeof(led_values) / sizeof(led_values[0]))]);
+                break;
+
+            default:
+                break;
+        }
+
+        if (status < 0)
+            w->errors++;
+        w->ops++;
+    }
+
+    close(fd);
+
+    return NULL;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Runs one round of the stress test
+ *
+ * @param threads The number of threads
+ * @param roles The roles which are distributed between the threads
+ * @param nroles The number of roles
+ * @param duration The duration of the round in seconds
+ *
+ * @return The number of broken invariants
+ */
+static long run_round(int threads, const enum ROLE *roles, int nroles,
+                      double duration)
+{
+    static struct worker_t workers[MAX_THREADS];
+    long ops[ROLE_END] = { 0 }, errors[ROLE_END] = { 0 };
+    long violations = 0;
+    int has_write = 0;
+    struct worker_t *last = NULL;
+    double start, elapsed;
+    int i, fd, level;
+    unsigned int generation;
+
+    memset(workers, 0, sizeof(workers));
+
+    __atomic_store_n(&running, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&injecting, 1, __ATOMIC_RELAXED);
+    start = now_sec();
+
+    for (i = 0; i < threads; ++i)
+    {
+        workers[i].role = roles[i % nroles];
+        workers[i].seed = (unsigned int)time(NULL) ^ (i * 2654435761u);
+        workers[i].last_written = -1;
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+
+    /* the writers go on alone, so the final state is one of their writes */
+    usleep((useconds_t)(duration * 0.75e6));
+    __atomic_store_n(&injecting, 0, __ATOMIC_RELAXED);
+    for (i = 0; i < threads; ++i)
+        if (workers[i].role == ROLE_NOTIFY)
+            pthread_join(workers[i].thread, NULL);
+
+    usleep((useconds_t)(duration * 0.25e6));
+    __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+
+    for (i = 0; i < threads; ++i)
+        if (workers[i].role != ROLE_NOTIFY)
+            pthread_join(workers[i].thread, NULL);
+
+    elapsed = now_sec() - start;
+
+    for (i = 0; i < threads; ++i)
+    {
+        ops[workers[i].role] += workers[i].ops;
+        errors[workers[i].role] += workers[i].errors;
+        violations += workers[i].violations;
+        has_write |= workers[i].role == ROLE_WRITE;
+    }
+
+    /* The final state is the write with the highest generation */
+    fd = open_role(ROLE_WRITE, O_RDONLY);
+    if (fd >= 0 && has_write && read_state(fd, &level, &generation) == 0)
+    {
+        for (i = 0; i < threads; ++i)
+            if (workers[i].role == ROLE_WRITE && workers[i].last_written >= 0 &&
+                (last == NULL ||
+                 workers[i].last_generation > last->last_generation))
+                last = &workers[i];
+
+        if (last == NULL)
+        {
+            fprintf(stderr, "no conditional write succeeded\n");
+            violations++;
+        }
+        else if ((level != last->last_written ||
+                             generation != last->last_generation + 1))
+        {
+            fprintf(stderr, "final state %d@%u is not the last write %d@%u\n",
+                    level, generation, last->last_written,
+                    last->last_generation + 1);
+            violations++;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    printf("%7d", threads);
+    for (i = 0; i < ROLE_END; ++i)
+        printf(" %10.0f %7ld", ops[i] / elapsed, errors[i]);
+    printf(" %10ld\n", violations);
+
+    return violations;
+}
+
+/**
+ * Writes the level and reads it back
+ *
+ * @param level The level
+ *
+ * @return Zero if the level is read back
+ */
+static int check_write_back(int level)
+{
+    int rfd, wfd, read_back = -1;
+
+    wfd = open_role(ROLE_WRITE, O_WRONLY);
+    rfd = open_role(ROLE_READ, O_RDONLY);
+    if (wfd < 0 || rfd < 0 || write_value(wfd, "%d\n", level) < 0 ||
+        read_level(rfd, &read_back) != 0 || read_back != level)
+    {
+        fprintf(stderr, "wrote level %d but read %d\n", level, read_back);
+        level = -1;
+    }
+
+    if (wfd >= 0)
+        close(wfd);
+    if (rfd >= 0)
+        close(rfd);
+
+    return level < 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-t threads] [-d seconds] [-m roles] [-r root]\n"
+            "  -t threads  comma separated thread counts (default 1,2,4,8)\n"
+            "  -d seconds  duration of every round (default 3)\n"
+            "  -m roles    r - read, w - write, n - Fn-key, l - LED (default rwnl)\n"
+            "  -r root     prefix of the driver files (default none)\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *thread_list = "1,2,4,8";
+    const char *mix = "rwnl";
+    double duration = 3;
+    enum ROLE roles[ROLE_END * 4];
+    int nroles = 0;
+    long violations = 0;
+    char *list, *token, *save;
+    int opt, i, level = -1;
+
+    while ((opt = getopt(argc, argv, "t:d:m:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': thread_list = optarg; break;
+            case 'd': duration = atof(optarg); break;
+            case 'm': mix = optarg; break;
+            case 'r': root = optarg; break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    for (; *mix && nroles < (int)(sizeof(roles) / sizeof(roles[0])); ++mix)
+    {
+        for (i = 0; i < ROLE_END && role_keys[i] != *mix; ++i)
+            ;
+        if (i == ROLE_END)
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        roles[nroles++] = i;
+    }
+
+    if (nroles == 0 || duration <= 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%7s", "threads");
+    for (i = 0; i < ROLE_END; ++i)
+        printf(" %8s/s %7s", role_names[i], "errors");
+    printf(" %10s\n", "violations");
+
+    list = strdup(thread_list);
+    for (token = strtok_r(list, ",", &save); token;
+         token = strtok_r(NULL, ",", &save))
+    {
+        int threads = atoi(token);
+
+        if (threads < 1 || threads > MAX_THREADS)
+        {
+            fprintf(stderr, "bad thread count: %s\n", token);
+            continue;
+        }
+
+        violations += run_round(threads, roles, nroles, duration);
+    }
+    free(list);
+
+    for (i = 0; i < nroles; ++i)
+        if (roles[i] == ROLE_WRITE)
+            level = MIN_LEVEL + (MAX_LEVEL - MIN_LEVEL) / 2;
+    if (level >= 0)
+        violations += check_write_back(level);
+
+    printf("%s: %ld invariant violations\n",
+           violations ? "FAILED" : "PASSED", violations);
+
+    return violations ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,542 @@
+/*
+  Copyright (C) 2008-2009 Piotr V. Abramov <piotr.abram@gmail.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+*/
+
+/**
+ * @file libamilo_pa2548.c
+ *
+ * The userspace client library of the driver, see libamilo_pa2548.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libamilo_pa2548.h"
+
+#define LCD_LEVEL_PATH      "/sys/devices/platform/amilo_pa2548/lcd_level"
+#define MAX_LEVEL_PATH      "/sys/class/backlight/amilo_pa2548/max_brightness"
+#define STATE_PATH          "/sys/devices/platform/amilo_pa2548/lcd_state"
+#define LED_PATH            "/sys/class/leds/amilo_pa2548::silentmode/brightness"
+
+#define DEFAULT_MAX_LEVEL   7
+
+/* the conditional writes retried by the blocking step */
+#define STEP_RETRIES        100
+
+/**
+ * @brief The handle of the driver
+ */
+struct amilo_pa2548
+{
+    char root[192];     /**< The prefix of the driver files */
+    int level_fd;       /**< lcd_level for reading and writing */
+    int event_fd;       /**< lcd_level for polling */
+    int state_fd;       /**< lcd_state, -1 if not opened yet */
+    int led_fd;         /**< The LED brightness, -1 if not opened yet */
+    int max_level;      /**< The max brightness level */
+
+    int fade_target;    /**< The target of the fade, -1 - no fade */
+    int fade_level;     /**< The level written by the last step */
+    unsigned int fade_interval_ms;  /**< The time between the steps */
+    long long fade_next_ms;         /**< The time of the next step */
+};
+
+static int open_file(const struct amilo_pa2548 *handle, const char *path,
+                     int flags)
+{
+    char full_path[256];
+
+    snprintf(full_path, sizeof(full_path), "%s%s", handle->root, path);
+
+    return open(full_path, flags);
+}
+
+static int read_int(int fd, int *value)
+{
+    char buf[32];
+    char *end;
+    ssize_t len;
+
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len < 0)
+        return -errno;
+    buf[len] = '\0';
+
+    *value = strtol(buf, &end, 0);
+    if (end == buf)
+        return -EIO;
+
+    return 0;
+}
+
+static int write_int(int fd, int value)
+{
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%d\n", value);
+
+    if (pwrite(fd, buf, len, 0) < 0)
+        return -errno;
+
+    return 0;
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(unsigned int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+/**
+ * Opens the driver
+ *
+ * @param root The prefix of the driver files or NULL
+ *
+ * @return The handle or NULL (errno is set)
+ */
+struct amilo_pa2548 *amilo_pa2548_open(const char *root)
+{
+    struct amilo_pa2548 *handle;
+    int fd, level;
+
+    handle = calloc(1, sizeof(*handle));
+    if (handle == NULL)
+        return NULL;
+
+    snprintf(handle->root, sizeof(handle->root), "%s", root ? root : "");
+    handle->state_fd = -1;
+    handle->led_fd = -1;
+    handle->event_fd = -1;
+    handle->max_level = DEFAULT_MAX_LEVEL;
+    handle->fade_target = -1;
+
+    handle->level_fd = open_file(handle, LCD_LEVEL_PATH, O_RDWR);
+    if (handle->level_fd < 0)
+        handle->level_fd = open_file(handle, LCD_LEVEL_PATH, O_RDONLY);
+    if (handle->level_fd < 0)
+    {
+        free(handle);
+        return NULL;
+    }
+
+    fd = open_file(handle, MAX_LEVEL_PATH, O_RDONLY);
+    if (fd >= 0)
+    {
+        if (read_int(fd, &level) == 0 && level > 0)
+            handle->max_level = level;
+        close(fd);
+    }
+
+    return handle;
+}
+
+/**
+ * Closes the driver
+ *
+ * @param handle The handle
+ */
+void amilo_pa2548_close(struct amilo_pa2548 *handle)
+{
+    if (handle == NULL)
+        return;
+
+    close(handle->level_fd);
+    if (handle->event_fd >= 0)
+        close(handle->event_fd);
+    if (handle->state_fd >= 0)
+        close(handle->state_fd);
+    if (handle->led_fd >= 0)
+        close(handle->led_fd);
+
+    free(handle);
+}
+
+/**
+ * Returns the max brightness level
+ */
+int amilo_pa2548_max_level(struct amilo_pa2548 *handle)
+{
+    return handle->max_level;
+}
+
+int amilo_pa2548_get_level(struct amilo_pa2548 *handle, int *level)
+{
+    return read_int(handle->level_fd, level);
+}
+
+int amilo_pa2548_set_level(struct amilo_pa2548 *handle, int level)
+{
+    if (level < 0 || level > handle->max_level)
+        return -EINVAL;
+
+    return write_int(handle->level_fd, level);
+}
+
+static int clamp_level(const struct amilo_pa2548 *handle, int level)
+{
+    if (level < 0)
+        return 0;
+    if (level > handle->max_level)
+        return handle->max_level;
+
+    return level;
+}
+
+/**
+ * Changes the brightness level by the delta once, stops at the borders;
+ * it does not block
+ *
+ * The level is set conditionally, so a concurrent change is not lost: on
+ * -EAGAIN the level was changed meanwhile, the caller retries, e.g. when
+ * the descriptor from amilo_pa2548_event_fd() reports the change.
+ *
+ * @param handle The handle
+ * @param delta The change of the level
+ * @param level The new level (may be NULL)
+ *
+ * @return The status, -EAGAIN if the level was changed meanwhile
+ */
+int amilo_pa2548_step_try(struct amilo_pa2548 *handle, int delta, int *level)
+{
+    unsigned int generation;
+    int current, status;
+
+    status = amilo_pa2548_get_state(handle, &current, &generation);
+    if (status < 0)
+        return status;
+
+    current = clamp_level(handle, current + delta);
+
+    status = amilo_pa2548_set_level_if(handle, current, generation);
+    if (status == 0 && level)
+        *level = current;
+
+    return status;
+}
+
+/**
+ * Changes the brightness level by the delta, stops at the borders; the
+ * concurrent steps are not lost
+ *
+ * @param handle The handle
+ * @param delta The change of the level
+ * @param level The new level (may be NULL)
+ *
+ * @return The status
+ */
+int amilo_pa2548_step(struct amilo_pa2548 *handle, int delta, int *level)
+{
+    int status, i;
+
+    for (i = 0; i < STEP_RETRIES; ++i)
+    {
+        status = amilo_pa2548_step_try(handle, delta, level);
+        if (status != -EAGAIN)
+            break;
+    }
+
+    return status;
+}
+
+/**
+ * Starts the fade to the target level, it does not block
+ *
+ * The steps are made by amilo_pa2548_fade_dispatch() when
+ * amilo_pa2548_fade_timeout() expires, so the fade runs in the event loop
+ * of the caller next to the descriptor from amilo_pa2548_event_fd(). A new
+ * fade replaces the running one.
+ *
+ * @param handle The handle
+ * @param level The target level
+ * @param duration_ms The duration of the whole fade
+ *
+ * @return The status
+ */
+int amilo_pa2548_fade_start(struct amilo_pa2548 *handle, int level,
+                            unsigned int duration_ms)
+{
+    unsigned int generation;
+    int current, status, steps;
+
+    if (level < 0 || level > handle->max_level)
+        return -EINVAL;
+
+    status = amilo_pa2548_get_state(handle, &current, &generation);
+    if (status < 0)
+        return status;
+
+    steps = abs(level - current);
+
+    handle->fade_target = level;
+    handle->fade_level = current;
+    handle->fade_interval_ms = steps > 1 ? duration_ms / (steps - 1) : 0;
+    handle->fade_next_ms = now_ms();
+
+    return 0;
+}
+
+/**
+ * Returns the time until the next step of the fade, for poll()
+ *
+ * @param handle The handle
+ *
+ * @return The time in ms, 0 if the step is due or -1 if there is no fade
+ */
+int amilo_pa2548_fade_timeout(struct amilo_pa2548 *handle)
+{
+    long long left;
+
+    if (handle->fade_target < 0)
+        return -1;
+
+    left = handle->fade_next_ms - now_ms();
+
+    return left > 0 ? (int)left : 0;
+}
+
+/**
+ * Makes the step of the fade if it is due, it does not block
+ *
+ * The fade is cancelled if somebody else changed the level since the last
+ * step.
+ *
+ * @param handle The handle
+ *
+ * @return 1 if the fade goes on, 0 if it is done or there is none, the
+ * error or -ECANCELED if the level was changed by somebody else
+ */
+int amilo_pa2548_fade_dispatch(struct amilo_pa2548 *handle)
+{
+    unsigned int generation;
+    int current, next, status;
+
+    if (handle->fade_target < 0)
+        return 0;
+
+    if (amilo_pa2548_fade_timeout(handle) > 0)
+        return 1;
+
+    status = amilo_pa2548_get_state(handle, &current, &generation);
+    if (status == 0 && current != handle->fade_level)
+        status = -ECANCELED;
+
+    if (status == 0 && current != handle->fade_target)
+    {
+        next = current + (handle->fade_target > current ? 1 : -1);
+        status = amilo_pa2548_set_level_if(handle, next, generation);
+        if (status == -EAGAIN)
+            status = -ECANCELED;
+        current = next;
+    }
+
+    if (status < 0 || current == handle->fade_target)
+    {
+        handle->fade_target = -1;
+        return status;
+    }
+
+    handle->fade_level = current;
+    handle->fade_next_ms += handle->fade_interval_ms;
+
+    return 1;
+}
+
+/**
+ * Changes the brightness level to the target one level by level, it blocks
+ * for the whole fade
+ *
+ * @param handle The handle
+ * @param level The target level
+ * @param duration_ms The duration of the whole fade
+ *
+ * @return The status
+ */
+int amilo_pa2548_fade(struct amilo_pa2548 *handle, int level,
+                      unsigned int duration_ms)
+{
+    int status, timeout;
+
+    status = amilo_pa2548_fade_start(handle, level, duration_ms);
+
+    while (status > 0 || (status == 0 && handle->fade_target >= 0))
+    {
+        timeout = amilo_pa2548_fade_timeout(handle);
+        if (timeout > 0)
+            sleep_ms(timeout);
+
+        status = amilo_pa2548_fade_dispatch(handle);
+    }
+
+    return status;
+}
+
+static int state_fd(struct amilo_pa2548 *handle)
+{
+    if (handle->state_fd < 0)
+    {
+        handle->state_fd = open_file(handle, STATE_PATH, O_RDWR);
+        if (handle->state_fd < 0)
+            handle->state_fd = open_file(handle, STATE_PATH, O_RDONLY);
+    }
+
+    return handle->state_fd < 0 ? -errno : handle->state_fd;
+}
+
+/**
+ * Reads the brightness level with its generation, which grows on every
+ * change of the level
+ *
+ * @param handle The handle
+ * @param level The brightness level
+ * @param generation The generation
+ *
+ * @return The status
+ */
+int amilo_pa2548_get_state(struct amilo_pa2548 *handle, int *level,
+                           unsigned int *generation)
+{
+    int fd = state_fd(handle);
+    char buf[64];
+    ssize_t len;
+
+    if (fd < 0)
+        return fd;
+
+    len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len < 0)
+        return -errno;
+    buf[len] = '\0';
+
+    if (sscanf(buf, "%i@%u", level, generation) != 2)
+        return -EIO;
+
+    return 0;
+}
+
+/**
+ * Sets the brightness level only if it was not changed since the state with
+ * the generation was read
+ *
+ * @param handle The handle
+ * @param level The brightness level
+ * @param generation The generation from amilo_pa2548_get_state()
+ *
+ * @return The status, -EAGAIN if the level was changed meanwhile
+ */
+int amilo_pa2548_set_level_if(struct amilo_pa2548 *handle, int level,
+                              unsigned int generation)
+{
+    int fd = state_fd(handle);
+    char buf[64];
+    int len;
+
+    if (fd < 0)
+        return fd;
+    if (level < 0 || level > handle->max_level)
+        return -EINVAL;
+
+    len = snprintf(buf, sizeof(buf), "%d@%u\n", level, generation);
+    if (pwrite(fd, buf, len, 0) < 0)
+        return -errno;
+
+    return 0;
+}
+
+static int led_fd(struct amilo_pa2548 *handle)
+{
+    if (handle->led_fd < 0)
+    {
+        handle->led_fd = open_file(handle, LED_PATH, O_RDWR);
+        if (handle->led_fd < 0)
+            handle->led_fd = open_file(handle, LED_PATH, O_RDONLY);
+    }
+
+    return handle->led_fd < 0 ? -errno : handle->led_fd;
+}
+
+int amilo_pa2548_get_led(struct amilo_pa2548 *handle, int *brightness)
+{
+    int fd = led_fd(handle);
+
+    return fd < 0 ? fd : read_int(fd, brightness);
+}
+
+int amilo_pa2548_set_led(struct amilo_pa2548 *handle, int brightness)
+{
+    int fd = led_fd(handle);
+
+    return fd < 0 ? fd : write_int(fd, brightness);
+}
+
+/**
+ * Returns the descriptor which is ready for POLLPRI when the brightness
+ * level is changed through the driver
+ *
+ * @param handle The handle
+ *
+ * @return The descriptor or the error
+ */
+int amilo_pa2548_event_fd(struct amilo_pa2548 *handle)
+{
+    int level;
+
+    if (handle->event_fd < 0)
+    {
+        handle->event_fd = open_file(handle, LCD_LEVEL_PATH, O_RDONLY);
+        if (handle->event_fd < 0)
+            return -errno;
+
+        /* sysfs reports the changes after the first read */
+        read_int(handle->event_fd, &level);
+    }
+
+    return handle->event_fd;
+}
+
+/**
+ * Reads the brightness level after the event and waits for the next one
+ *
+ * @param handle The handle
+ * @param level The current brightness level
+ *
+ * @return The status
+ */
+int amilo_pa2548_read_event(struct amilo_pa2548 *handle, int *level)
+{
+    int fd = amilo_pa2548_event_fd(handle);
+
+    return fd < 0 ? fd : read_int(fd, level);
+}
@@ -0,0 +1,96 @@
+/*
+  Copyright (C) 2008-2009 Piotr V. Abramov <piotr.abram@gmail.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+  02110-1301, USA.
+*/
+
+/**
+ * @file libamilo_pa2548.h
+ *
+ * The userspace client library of the driver. It keeps the driver files
+ * open, so every operation is one pread()/pwrite() without the path lookup,
+ * and it parses the values once for all the clients.
+ *
+ * All the functions return zero (or a non-negative value) on success and
+ * a negative errno on failure.
+ *
+ * The brightness changes are delivered asynchronously: poll the descriptor
+ * from amilo_pa2548_event_fd() for POLLPRI in any event loop and call
+ * amilo_pa2548_read_event() when it is ready.
+ *
+ * amilo_pa2548_step() and amilo_pa2548_fade() block the caller. The event
+ * loops use the non-blocking ones instead: amilo_pa2548_step_try() makes
+ * one conditional step and returns -EAGAIN if the level was changed
+ * meanwhile (retry it when the descriptor is ready), and a fade started by
+ * amilo_pa2548_fade_start() is driven by the loop:
+ *
+ *   struct pollfd pfd = { amilo_pa2548_event_fd(h), POLLPRI, 0 };
+ *
+ *   amilo_pa2548_fade_start(h, 0, 500);
+ *   while (poll(&pfd, 1, amilo_pa2548_fade_timeout(h)) >= 0)
+ *   {
+ *       if (pfd.revents & POLLPRI)
+ *           amilo_pa2548_read_event(h, &level);
+ *       if (amilo_pa2548_fade_dispatch(h) <= 0)
+ *           break;
+ *   }
+ */
+
+#ifndef LIBAMILO_PA2548_H
+#define LIBAMILO_PA2548_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The opaque handle of the driver
+ */
+struct amilo_pa2548;
+
+struct amilo_pa2548 *amilo_pa2548_open(const char *root);
+void amilo_pa2548_close(struct amilo_pa2548 *handle);
+
+int amilo_pa2548_max_level(struct amilo_pa2548 *handle);
+
+int amilo_pa2548_get_level(struct amilo_pa2548 *handle, int *level);
+int amilo_pa2548_set_level(struct amilo_pa2548 *handle, int level);
+int amilo_pa2548_step(struct amilo_pa2548 *handle, int delta, int *level);
+int amilo_pa2548_fade(struct amilo_pa2548 *handle, int level,
+                      unsigned int duration_ms);
+
+int amilo_pa2548_step_try(struct amilo_pa2548 *handle, int delta, int *level);
+int amilo_pa2548_fade_start(struct amilo_pa2548 *handle, int level,
+                            unsigned int duration_ms);
+int amilo_pa2548_fade_timeout(struct amilo_pa2548 *handle);
+int amilo_pa2548_fade_dispatch(struct amilo_pa2548 *handle);
+
+int amilo_pa2548_get_state(struct amilo_pa2548 *handle, int *level,
+                           unsigned int *generation);
+int amilo_pa2548_set_level_if(struct amilo_pa2548 *handle, int level,
+                              unsigned int generation);
+
+int amilo_pa2548_get_led(struct amilo_pa2548 *handle, int *brightness);
+int amilo_pa2548_set_led(struct amilo_pa2548 *handle, int brightness);
+
+int amilo_pa2548_event_fd(struct amilo_pa2548 *handle);
+int amilo_pa2548_read_event(struct amilo_pa2548 *handle, int *level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBAMILO_PA2548_H */